@@ -92,6 +92,8 @@ void __ipipe_handle_irq(unsigned irq, struct pt_regs *regs)
 	struct ipipe_irqdesc *idesc;
 	int m_ack, s = -1;
 
+	__ipipe_latency_entry();
+
 	/*
 	 * Software-triggered IRQs do not need any ack.  The contents
 	 * of the register frame should only be used when processing
@@ -244,6 +246,12 @@ unsigned long ipipe_critical_enter(void (*syncfn) (void))
 	return flags;
 }
 
+unsigned long ipipe_critical_enter_mask(void (*syncfn) (void),
+					const struct cpumask *mask)
+{
+	return ipipe_critical_enter(syncfn);
+}
+
 void ipipe_critical_exit(unsigned long flags)
 {
 	hard_local_irq_restore(flags);
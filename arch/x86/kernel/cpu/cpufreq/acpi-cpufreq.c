@@ -39,6 +39,7 @@
 #include <linux/io.h>
 #include <linux/delay.h>
 #include <linux/uaccess.h>
+#include <linux/ipipe.h>
 
 #include <acpi/processor.h>
 
@@ -374,6 +375,51 @@ out:
 	return result;
 }
 
+/*
+ * Atomic-context variant of acpi_cpufreq_target(): only the local
+ * PERF_CTL MSR can be written with interrupts off, so it is limited to
+ * MSR-capable systems whose policy needs no write on other CPUs.
+ */
+static unsigned int acpi_cpufreq_fast_switch(struct cpufreq_policy *policy,
+					     unsigned int target_freq)
+{
+	struct acpi_cpufreq_data *data = per_cpu(acfreq_data, policy->cpu);
+	struct acpi_processor_performance *perf;
+	unsigned int next_state = 0; /* Index into freq_table */
+	unsigned int next_perf_state = 0; /* Index into perf table */
+	u32 lo, hi;
+
+	if (unlikely(data == NULL ||
+	     data->acpi_data == NULL || data->freq_table == NULL))
+		return 0;
+
+	if (data->cpu_feature != SYSTEM_INTEL_MSR_CAPABLE ||
+	    unlikely(data->resume) || acpi_pstate_strict)
+		return 0;
+
+	if (ipipe_processor_id() != policy->cpu ||
+	    (policy->shared_type != CPUFREQ_SHARED_TYPE_ANY &&
+	     cpumask_weight(policy->cpus) > 1))
+		return 0;
+
+	if (cpufreq_frequency_table_target(policy, data->freq_table,
+					   target_freq, CPUFREQ_RELATION_L,
+					   &next_state))
+		return 0;
+
+	perf = data->acpi_data;
+	next_perf_state = data->freq_table[next_state].index;
+	if (perf->state != next_perf_state) {
+		rdmsr(MSR_IA32_PERF_CTL, lo, hi);
+		lo = (lo & ~INTEL_MSR_RANGE) |
+		     ((u32) perf->states[next_perf_state].control & INTEL_MSR_RANGE);
+		wrmsr(MSR_IA32_PERF_CTL, lo, hi);
+		perf->state = next_perf_state;
+	}
+
+	return data->freq_table[next_state].frequency;
+}
+
 static int acpi_cpufreq_verify(struct cpufreq_policy *policy)
 {
 	struct acpi_cpufreq_data *data = per_cpu(acfreq_data, policy->cpu);
@@ -658,8 +704,10 @@ static int acpi_cpufreq_cpu_init(struct cpufreq_policy *policy)
 	acpi_processor_notify_smm(THIS_MODULE);
 
 	/* Check for APERF/MPERF support in hardware */
-	if (cpu_has(c, X86_FEATURE_APERFMPERF))
+	if (cpu_has(c, X86_FEATURE_APERFMPERF)) {
 		acpi_cpufreq_driver.getavg = cpufreq_get_measured_perf;
+		acpi_cpufreq_driver.read_perf = cpufreq_read_perf_ctrs;
+	}
 
 	dprintk("CPU%u - ACPI performance management activated.\n", cpu);
 	for (i = 0; i < perf->state_count; i++)
@@ -727,6 +775,7 @@ static struct freq_attr *acpi_cpufreq_attr[] = {
 static struct cpufreq_driver acpi_cpufreq_driver = {
 	.verify		= acpi_cpufreq_verify,
 	.target		= acpi_cpufreq_target,
+	.fast_switch	= acpi_cpufreq_fast_switch,
 	.bios_limit	= acpi_processor_get_bios_limit,
 	.init		= acpi_cpufreq_cpu_init,
 	.exit		= acpi_cpufreq_cpu_exit,
@@ -48,4 +48,19 @@ unsigned int cpufreq_get_measured_perf(struct cpufreq_policy *policy,
 	return retval;
 }
 EXPORT_SYMBOL_GPL(cpufreq_get_measured_perf);
+
+/*
+ * Raw IA32_APERF/IA32_MPERF of the calling CPU, for ->read_perf. Unlike
+ * cpufreq_get_measured_perf() it keeps no state, so callers can account
+ * arbitrary intervals (e.g. per task) without disturbing ->getavg.
+ */
+void cpufreq_read_perf_ctrs(u64 *aperf, u64 *mperf)
+{
+	struct aperfmperf perf;
+
+	get_aperfmperf(&perf);
+	*aperf = perf.aperf;
+	*mperf = perf.mperf;
+}
+EXPORT_SYMBOL_GPL(cpufreq_read_perf_ctrs);
 MODULE_LICENSE("GPL");
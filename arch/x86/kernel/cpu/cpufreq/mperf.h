@@ -7,3 +7,4 @@
 
 unsigned int cpufreq_get_measured_perf(struct cpufreq_policy *policy,
 					unsigned int cpu);
+void cpufreq_read_perf_ctrs(u64 *aperf, u64 *mperf);
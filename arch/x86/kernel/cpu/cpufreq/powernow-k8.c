@@ -35,6 +35,7 @@
 #include <linux/sched.h>	/* for current / set_cpus_allowed() */
 #include <linux/io.h>
 #include <linux/delay.h>
+#include <linux/ipipe.h>
 
 #include <asm/msr.h>
 
@@ -1210,6 +1211,37 @@ err_out:
 	return ret;
 }
 
+/*
+ * Driver entry point to switch frequency with interrupts off: a hardware
+ * pstate change is a single local MSR write, so this is only offered on
+ * CPU_HW_PSTATE parts and when already running on pol->cpu. The fid/vid
+ * sequence needs fidvid_mutex and waits, and stays on powernowk8_target().
+ */
+static unsigned int powernowk8_fast_switch(struct cpufreq_policy *pol,
+		unsigned targfreq)
+{
+	struct powernow_k8_data *data = per_cpu(powernow_data, pol->cpu);
+	unsigned int newstate;
+	u32 pstate;
+
+	if (!data || cpu_family != CPU_HW_PSTATE ||
+	    ipipe_processor_id() != pol->cpu)
+		return 0;
+
+	if (cpufreq_frequency_table_target(pol, data->powernow_table,
+				targfreq, CPUFREQ_RELATION_L, &newstate))
+		return 0;
+
+	pstate = newstate & HW_PSTATE_MASK;
+	if (pstate > data->max_hw_pstate)
+		return 0;
+
+	if (pstate != data->currpstate)
+		transition_pstate(data, pstate);
+
+	return find_khz_freq_from_pstate(data->powernow_table, pstate);
+}
+
 /* Driver entry point to verify the policy and range of frequencies */
 static int powernowk8_verify(struct cpufreq_policy *pol)
 {
@@ -1332,8 +1364,10 @@ static int __cpuinit powernowk8_cpu_init(struct cpufreq_policy *pol)
 	}
 
 	/* Check for APERF/MPERF support in hardware */
-	if (cpu_has(c, X86_FEATURE_APERFMPERF))
+	if (cpu_has(c, X86_FEATURE_APERFMPERF)) {
 		cpufreq_amd64_driver.getavg = cpufreq_get_measured_perf;
+		cpufreq_amd64_driver.read_perf = cpufreq_read_perf_ctrs;
+	}
 
 	cpufreq_frequency_table_get_attr(data->powernow_table, pol->cpu);
 
@@ -1483,6 +1517,7 @@ static struct freq_attr *powernow_k8_attr[] = {
 static struct cpufreq_driver cpufreq_amd64_driver = {
 	.verify		= powernowk8_verify,
 	.target		= powernowk8_target,
+	.fast_switch	= powernowk8_fast_switch,
 	.bios_limit	= acpi_processor_get_bios_limit,
 	.init		= powernowk8_cpu_init,
 	.exit		= __devexit_p(powernowk8_cpu_exit),
@@ -726,6 +726,8 @@ int __ipipe_handle_irq(struct pt_regs *regs)
 	struct pt_regs *tick_regs;
 	int m_ack;
 
+	__ipipe_latency_entry();
+
 	if (vector < 0) {
 		irq = __get_cpu_var(vector_irq)[~vector];
 		BUG_ON(irq < 0);
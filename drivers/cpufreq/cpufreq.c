@@ -28,6 +28,9 @@
 #include <linux/cpu.h>
 #include <linux/completion.h>
 #include <linux/mutex.h>
+#include <linux/irq_work.h>
+#include <linux/workqueue.h>
+#include <linux/ipipe.h>
 
 #include <trace/events/power.h>
 
@@ -47,6 +50,19 @@ static DEFINE_PER_CPU(char[CPUFREQ_NAME_LEN], cpufreq_cpu_governor);
 #endif
 static DEFINE_SPINLOCK(cpufreq_driver_lock);
 
+/*
+ * Lockless users of cpufreq_driver, which may run over the I-pipe head
+ * domain where cpufreq_driver_lock cannot be taken, keep hw IRQs off
+ * instead; cpufreq_unregister_driver() waits for them to leave.
+ */
+#ifdef CONFIG_IPIPE
+#define cpufreq_driver_hold(flags)	local_irq_save_hw(flags)
+#define cpufreq_driver_unhold(flags)	local_irq_restore_hw(flags)
+#else
+#define cpufreq_driver_hold(flags)	local_irq_save(flags)
+#define cpufreq_driver_unhold(flags)	local_irq_restore(flags)
+#endif
+
 /*
  * cpu_policy_rwsem is a per CPU reader-writer semaphore designed to cure
  * all cpufreq/hotplug/workqueue/etc related lock issues.
@@ -318,6 +334,29 @@ static inline void adjust_jiffies(unsigned long val, struct cpufreq_freqs *ci)
  * function. It is called twice on all CPU frequency changes that have
  * external effects.
  */
+static void __cpufreq_notify_transition(struct cpufreq_freqs *freqs,
+					unsigned int state)
+{
+	switch (state) {
+
+	case CPUFREQ_PRECHANGE:
+		srcu_notifier_call_chain(&cpufreq_transition_notifier_list,
+				CPUFREQ_PRECHANGE, freqs);
+		adjust_jiffies(CPUFREQ_PRECHANGE, freqs);
+		break;
+
+	case CPUFREQ_POSTCHANGE:
+		adjust_jiffies(CPUFREQ_POSTCHANGE, freqs);
+		dprintk("FREQ: %lu - CPU: %lu", (unsigned long)freqs->new,
+			(unsigned long)freqs->cpu);
+		trace_power_frequency(POWER_PSTATE, freqs->new, freqs->cpu);
+		trace_cpu_frequency(freqs->new, freqs->cpu);
+		srcu_notifier_call_chain(&cpufreq_transition_notifier_list,
+				CPUFREQ_POSTCHANGE, freqs);
+		break;
+	}
+}
+
 void cpufreq_notify_transition(struct cpufreq_freqs *freqs, unsigned int state)
 {
 	struct cpufreq_policy *policy;
@@ -345,19 +384,11 @@ void cpufreq_notify_transition(struct cpufreq_freqs *freqs, unsigned int state)
 				freqs->old = policy->cur;
 			}
 		}
-		srcu_notifier_call_chain(&cpufreq_transition_notifier_list,
-				CPUFREQ_PRECHANGE, freqs);
-		adjust_jiffies(CPUFREQ_PRECHANGE, freqs);
+		__cpufreq_notify_transition(freqs, CPUFREQ_PRECHANGE);
 		break;
 
 	case CPUFREQ_POSTCHANGE:
-		adjust_jiffies(CPUFREQ_POSTCHANGE, freqs);
-		dprintk("FREQ: %lu - CPU: %lu", (unsigned long)freqs->new,
-			(unsigned long)freqs->cpu);
-		trace_power_frequency(POWER_PSTATE, freqs->new, freqs->cpu);
-		trace_cpu_frequency(freqs->new, freqs->cpu);
-		srcu_notifier_call_chain(&cpufreq_transition_notifier_list,
-				CPUFREQ_POSTCHANGE, freqs);
+		__cpufreq_notify_transition(freqs, CPUFREQ_POSTCHANGE);
 		if (likely(policy) && likely(policy->cpu == freqs->cpu))
 			policy->cur = freqs->new;
 		break;
@@ -1003,6 +1034,7 @@ static int cpufreq_add_dev(struct sys_device *sys_dev)
 	policy = kzalloc(sizeof(struct cpufreq_policy), GFP_KERNEL);
 	if (!policy)
 		goto nomem_out;
+	mutex_init(&policy->target_mutex);
 
 	if (!alloc_cpumask_var(&policy->cpus, GFP_KERNEL))
 		goto err_free_policy;
@@ -1547,13 +1579,177 @@ int __cpufreq_driver_target(struct cpufreq_policy *policy,
 
 	dprintk("target for CPU %u: %u kHz, relation %u\n", policy->cpu,
 		target_freq, relation);
-	if (cpu_online(policy->cpu) && cpufreq_driver->target)
-		retval = cpufreq_driver->target(policy, target_freq, relation);
+	if (!cpu_online(policy->cpu) || !cpufreq_driver->target)
+		return retval;
+
+	/*
+	 * ->target() may sleep, so callers queue on target_mutex. The
+	 * switch_lock bit then tells ->fast_switch(), which may run from an
+	 * interrupt or the head domain and updates policy->cur and the
+	 * driver's state too, to give up. Once we own the mutex, the bit can
+	 * only be held by a fast switch, which runs with hw IRQs off on
+	 * another CPU and does not sleep: the wait below is short.
+	 */
+	mutex_lock(&policy->target_mutex);
+	while (test_and_set_bit_lock(0, &policy->switch_lock))
+		cpu_relax();
+
+	retval = cpufreq_driver->target(policy, target_freq, relation);
+
+	clear_bit_unlock(0, &policy->switch_lock);
+	mutex_unlock(&policy->target_mutex);
 
 	return retval;
 }
 EXPORT_SYMBOL_GPL(__cpufreq_driver_target);
 
+#if defined(CONFIG_IPIPE) || defined(CONFIG_IRQ_WORK)
+/*
+ * Fast frequency switching. ->fast_switch() runs with interrupts off, where
+ * the transition notifiers cannot, so the core only updates policy->cur and
+ * remembers the frequency the policy had before its first unnotified
+ * switch. A kick then schedules a work item which sends one
+ * PRECHANGE/POSTCHANGE pair per policy from process context, collapsing
+ * every fast switch made in between. With the I-pipe the caller may be in
+ * the head domain, where irq_work cannot be used, so the kick is a virtual
+ * IRQ handled by the root domain; otherwise it is an irq_work.
+ */
+static DEFINE_PER_CPU(unsigned int, cpufreq_fast_old);	/* 0: nothing pending */
+
+static void cpufreq_fast_notify_workfn(struct work_struct *work)
+{
+	struct cpufreq_policy *policy;
+	struct cpufreq_freqs freqs;
+	unsigned int cpu, i;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		freqs.old = xchg(&per_cpu(cpufreq_fast_old, cpu), 0);
+		if (!freqs.old)
+			continue;
+
+		policy = cpufreq_cpu_get(cpu);
+		if (!policy)
+			continue;
+
+		freqs.new = ACCESS_ONCE(policy->cur);
+		freqs.flags = cpufreq_driver->flags | CPUFREQ_NOTIFY_DEFERRED;
+		if (freqs.new != freqs.old) {
+			for_each_cpu(i, policy->cpus) {
+				freqs.cpu = i;
+				__cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+			}
+			for_each_cpu(i, policy->cpus) {
+				freqs.cpu = i;
+				__cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+			}
+		}
+		cpufreq_cpu_put(policy);
+	}
+	put_online_cpus();
+}
+
+static DECLARE_WORK(cpufreq_fast_notify_work, cpufreq_fast_notify_workfn);
+
+#ifdef CONFIG_IPIPE
+static unsigned cpufreq_fast_notify_virq;
+
+static void cpufreq_fast_notify_handler(unsigned int irq, void *cookie)
+{
+	schedule_work(&cpufreq_fast_notify_work);
+}
+
+static void __init cpufreq_fast_notify_init(void)
+{
+	cpufreq_fast_notify_virq = ipipe_alloc_virq();
+	if (!cpufreq_fast_notify_virq)
+		return;
+
+	if (ipipe_virtualize_irq(ipipe_root_domain, cpufreq_fast_notify_virq,
+				 &cpufreq_fast_notify_handler, NULL, NULL,
+				 IPIPE_HANDLE_MASK)) {
+		ipipe_free_virq(cpufreq_fast_notify_virq);
+		cpufreq_fast_notify_virq = 0;
+	}
+}
+
+#define cpufreq_fast_notify_ready()	(cpufreq_fast_notify_virq != 0)
+#define cpufreq_fast_notify_kick()	ipipe_trigger_irq(cpufreq_fast_notify_virq)
+#else
+static void cpufreq_fast_notify_irq_work(struct irq_work *entry)
+{
+	schedule_work(&cpufreq_fast_notify_work);
+}
+
+static struct irq_work cpufreq_fast_notify_entry;
+
+static void __init cpufreq_fast_notify_init(void)
+{
+	init_irq_work(&cpufreq_fast_notify_entry, cpufreq_fast_notify_irq_work);
+}
+
+#define cpufreq_fast_notify_ready()	1
+#define cpufreq_fast_notify_kick()	irq_work_queue(&cpufreq_fast_notify_entry)
+#endif /* CONFIG_IPIPE */
+
+/**
+ * cpufreq_driver_fast_switch - switch frequency from atomic context
+ * @policy: policy to change; the caller must run on one of policy->cpus
+ * @target_freq: lowest acceptable frequency, in kHz
+ *
+ * May be called with interrupts off, from any context that keeps @policy
+ * alive (usually its governor). Transition notifiers are deferred and
+ * batched. Returns the frequency set, or 0 if the driver cannot switch from
+ * here, in which case the caller falls back to __cpufreq_driver_target().
+ */
+unsigned int cpufreq_driver_fast_switch(struct cpufreq_policy *policy,
+					unsigned int target_freq)
+{
+	struct cpufreq_driver *driver;
+	unsigned int old, new = 0;
+	unsigned long flags;
+
+	if (!cpufreq_fast_notify_ready())
+		return 0;
+
+	cpufreq_driver_hold(flags);
+
+	driver = ACCESS_ONCE(cpufreq_driver);
+	if (!driver || !driver->fast_switch)
+		goto out;
+
+	/* ->target() in progress: let the caller fall back */
+	if (test_and_set_bit_lock(0, &policy->switch_lock))
+		goto out;
+
+	target_freq = clamp_val(target_freq, policy->min, policy->max);
+	old = policy->cur;
+	new = driver->fast_switch(policy, target_freq);
+	if (new && new != old) {
+		policy->cur = new;
+		cmpxchg(&per_cpu(cpufreq_fast_old, policy->cpu), 0, old);
+	}
+
+	clear_bit_unlock(0, &policy->switch_lock);
+out:
+	cpufreq_driver_unhold(flags);
+
+	if (new && new != old)
+		cpufreq_fast_notify_kick();
+
+	return new;
+}
+#else
+static inline void cpufreq_fast_notify_init(void) { }
+
+unsigned int cpufreq_driver_fast_switch(struct cpufreq_policy *policy,
+					unsigned int target_freq)
+{
+	return 0;
+}
+#endif /* CONFIG_IPIPE || CONFIG_IRQ_WORK */
+EXPORT_SYMBOL_GPL(cpufreq_driver_fast_switch);
+
 int cpufreq_driver_target(struct cpufreq_policy *policy,
 			  unsigned int target_freq,
 			  unsigned int relation)
@@ -1594,6 +1790,35 @@ int __cpufreq_driver_getavg(struct cpufreq_policy *policy, unsigned int cpu)
 }
 EXPORT_SYMBOL_GPL(__cpufreq_driver_getavg);
 
+/**
+ * cpufreq_driver_read_perf - read the cycle counters of the calling CPU
+ * @actual: cycles retired at the actual frequency
+ * @reference: cycles at cpuinfo.max_freq over the same time
+ *
+ * Both counters advance only while the CPU is active, so their differences
+ * over an interval give the busy time and the average frequency within it.
+ * Callable from any context, including with interrupts off or over the
+ * head domain. Returns -ENODEV if there is no driver or it cannot read
+ * them.
+ */
+int cpufreq_driver_read_perf(u64 *actual, u64 *reference)
+{
+	struct cpufreq_driver *driver;
+	unsigned long flags;
+	int ret = -ENODEV;
+
+	cpufreq_driver_hold(flags);
+	driver = ACCESS_ONCE(cpufreq_driver);
+	if (driver && driver->read_perf) {
+		driver->read_perf(actual, reference);
+		ret = 0;
+	}
+	cpufreq_driver_unhold(flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(cpufreq_driver_read_perf);
+
 /*
  * when "event" is CPUFREQ_GOV_LIMITS
  */
@@ -2006,6 +2231,13 @@ int cpufreq_unregister_driver(struct cpufreq_driver *driver)
 	cpufreq_driver = NULL;
 	spin_unlock_irqrestore(&cpufreq_driver_lock, flags);
 
+	/* wait for the lockless users (see cpufreq_driver_hold()) */
+#ifdef CONFIG_IPIPE
+	flags = ipipe_critical_enter(NULL);
+	ipipe_critical_exit(flags);
+#endif
+	synchronize_sched();
+
 	return 0;
 }
 EXPORT_SYMBOL_GPL(cpufreq_unregister_driver);
@@ -2019,6 +2251,8 @@ static int __init cpufreq_core_init(void)
 		init_rwsem(&per_cpu(cpu_policy_rwsem, cpu));
 	}
 
+	cpufreq_fast_notify_init();
+
 	cpufreq_global_kobject = kobject_create_and_add("cpufreq",
 						&cpu_sysdev_class.kset.kobj);
 	BUG_ON(!cpufreq_global_kobject);
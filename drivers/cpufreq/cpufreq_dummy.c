@@ -0,0 +1,291 @@
+/*
+ * linux/drivers/cpufreq/cpufreq_dummy.c
+ *
+ * Software cpufreq driver: emulates a CPU with a configurable frequency
+ * table and transition latency, so that frequency policies can be
+ * exercised on hardware (or virtual machines) without a P-state driver.
+ *
+ * The emulated frequency has no effect on the real clock. Instead, code
+ * that wants to observe it retires "virtual cycles" through
+ * cpufreq_dummy_run_cycles(), which spins for cycles / cur_freq seconds,
+ * so a busy loop slows down proportionally when the governor lowers the
+ * frequency.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpufreq_dummy.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+
+#define dprintk(msg...) cpufreq_debug_printk(CPUFREQ_DEBUG_DRIVER, \
+						"dummy-cpufreq", msg)
+
+/* length of one uninterrupted busy-loop slice in cpufreq_dummy_run_cycles() */
+#define DUMMY_SLICE_NS		10000ULL
+
+static unsigned int freqs[CPUFREQ_DUMMY_MAX_STATES] = {
+	400000, 800000, 1200000, 1600000, 2000000,
+};
+static unsigned int nr_freqs = 5;
+static unsigned int volts[CPUFREQ_DUMMY_MAX_STATES];
+static unsigned int nr_volts;
+static unsigned int latency = 100;	/* us */
+
+module_param_array(freqs, uint, &nr_freqs, 0444);
+MODULE_PARM_DESC(freqs, "Frequency table in kHz (comma separated)");
+module_param_array(volts, uint, &nr_volts, 0444);
+MODULE_PARM_DESC(volts, "Voltage of each frequency in mV (default: 900-1300 mV linear)");
+module_param(latency, uint, 0444);
+MODULE_PARM_DESC(latency, "Emulated transition latency in us");
+
+static struct cpufreq_frequency_table dummy_table[CPUFREQ_DUMMY_MAX_STATES + 1];
+static unsigned int dummy_volts[CPUFREQ_DUMMY_MAX_STATES];
+static unsigned int dummy_nstates;
+
+struct dummy_cpu_state {
+	spinlock_t	lock;
+	unsigned int	cur;		/* index into dummy_table */
+	u64		last_ns;	/* last residency update */
+	u64		cycles;		/* virtual cycles retired */
+	u64		busy_ns[CPUFREQ_DUMMY_MAX_STATES];
+	u64		resid_ns[CPUFREQ_DUMMY_MAX_STATES];
+};
+
+static DEFINE_PER_CPU(struct dummy_cpu_state, dummy_cpu_state);
+
+/* caller holds st->lock */
+static void dummy_update_residency(struct dummy_cpu_state *st, u64 now)
+{
+	if (now > st->last_ns)
+		st->resid_ns[st->cur] += now - st->last_ns;
+	st->last_ns = now;
+}
+
+u64 cpufreq_dummy_run_cycles(u64 cycles)
+{
+	u64 start = local_clock();
+	u64 done = 0;
+
+	while (done < cycles) {
+		struct dummy_cpu_state *st;
+		unsigned long flags;
+		unsigned int cur, freq;
+		u64 slice, t0, elapsed;
+
+		preempt_disable();
+		st = &__get_cpu_var(dummy_cpu_state);
+		cur = ACCESS_ONCE(st->cur);
+		freq = dummy_table[cur].frequency;
+
+		/* kHz * ns / 10^6 = cycles */
+		slice = div64_u64((cycles - done) * 1000000ULL + freq - 1, freq);
+		if (slice > DUMMY_SLICE_NS)
+			slice = DUMMY_SLICE_NS;
+
+		t0 = local_clock();
+		do {
+			cpu_relax();
+			elapsed = local_clock() - t0;
+		} while (elapsed < slice);
+
+		spin_lock_irqsave(&st->lock, flags);
+		st->busy_ns[cur] += elapsed;
+		st->cycles += div64_u64(elapsed * freq, 1000000ULL);
+		spin_unlock_irqrestore(&st->lock, flags);
+		preempt_enable();
+
+		done += div64_u64(elapsed * freq, 1000000ULL);
+	}
+
+	return local_clock() - start;
+}
+EXPORT_SYMBOL_GPL(cpufreq_dummy_run_cycles);
+
+int cpufreq_dummy_snapshot(unsigned int cpu, struct cpufreq_dummy_state *state,
+			   unsigned int nstates)
+{
+	struct dummy_cpu_state *st;
+	unsigned long flags;
+	unsigned int i;
+
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return -EINVAL;
+
+	st = &per_cpu(dummy_cpu_state, cpu);
+	nstates = min(nstates, dummy_nstates);
+
+	spin_lock_irqsave(&st->lock, flags);
+	dummy_update_residency(st, local_clock());
+	for (i = 0; i < nstates; i++) {
+		state[i].freq = dummy_table[i].frequency;
+		state[i].voltage = dummy_volts[i];
+		state[i].busy_ns = st->busy_ns[i];
+		state[i].resid_ns = st->resid_ns[i];
+	}
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	return nstates;
+}
+EXPORT_SYMBOL_GPL(cpufreq_dummy_snapshot);
+
+static unsigned int dummy_cpufreq_get(unsigned int cpu)
+{
+	return dummy_table[per_cpu(dummy_cpu_state, cpu).cur].frequency;
+}
+
+static int dummy_cpufreq_verify(struct cpufreq_policy *policy)
+{
+	return cpufreq_frequency_table_verify(policy, dummy_table);
+}
+
+static int dummy_cpufreq_target(struct cpufreq_policy *policy,
+				unsigned int target_freq,
+				unsigned int relation)
+{
+	struct dummy_cpu_state *st = &per_cpu(dummy_cpu_state, policy->cpu);
+	struct cpufreq_freqs freqs;
+	unsigned int newstate;
+	unsigned long flags;
+
+	if (cpufreq_frequency_table_target(policy, dummy_table, target_freq,
+					   relation, &newstate))
+		return -EINVAL;
+
+	freqs.cpu = policy->cpu;
+	freqs.old = dummy_table[st->cur].frequency;
+	freqs.new = dummy_table[newstate].frequency;
+
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+
+	/* the emulated CPU does not retire cycles while it relocks its PLL */
+	if (latency)
+		udelay(latency);
+
+	spin_lock_irqsave(&st->lock, flags);
+	dummy_update_residency(st, local_clock());
+	st->cur = newstate;
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+
+	dprintk("cpu %u: %u -> %u kHz\n", policy->cpu, freqs.old, freqs.new);
+	return 0;
+}
+
+static int dummy_cpufreq_cpu_init(struct cpufreq_policy *policy)
+{
+	struct dummy_cpu_state *st = &per_cpu(dummy_cpu_state, policy->cpu);
+	unsigned int i, max = 0;
+	unsigned long flags;
+	int ret;
+
+	for (i = 1; i < dummy_nstates; i++)
+		if (dummy_table[i].frequency > dummy_table[max].frequency)
+			max = i;
+
+	spin_lock_irqsave(&st->lock, flags);
+	memset(st->busy_ns, 0, sizeof(st->busy_ns));
+	memset(st->resid_ns, 0, sizeof(st->resid_ns));
+	st->cycles = 0;
+	st->cur = max;
+	st->last_ns = local_clock();
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, dummy_table);
+	if (ret)
+		return ret;
+
+	cpufreq_frequency_table_get_attr(dummy_table, policy->cpu);
+
+	policy->cpuinfo.transition_latency = latency * 1000;
+	policy->cur = dummy_table[max].frequency;
+
+	return 0;
+}
+
+static int dummy_cpufreq_cpu_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+	return 0;
+}
+
+static struct freq_attr *dummy_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
+static struct cpufreq_driver dummy_cpufreq_driver = {
+	.verify		= dummy_cpufreq_verify,
+	.target		= dummy_cpufreq_target,
+	.init		= dummy_cpufreq_cpu_init,
+	.exit		= dummy_cpufreq_cpu_exit,
+	.get		= dummy_cpufreq_get,
+	.name		= "dummy-cpufreq",
+	.owner		= THIS_MODULE,
+	.attr		= dummy_cpufreq_attr,
+};
+
+static int __init dummy_cpufreq_init(void)
+{
+	unsigned int i, fmin = UINT_MAX, fmax = 0;
+	int cpu;
+
+	if (!nr_freqs || nr_freqs > CPUFREQ_DUMMY_MAX_STATES)
+		return -EINVAL;
+	if (nr_volts && nr_volts != nr_freqs) {
+		printk(KERN_ERR "dummy-cpufreq: %u voltages for %u frequencies\n",
+		       nr_volts, nr_freqs);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nr_freqs; i++) {
+		if (!freqs[i])
+			return -EINVAL;
+		fmin = min(fmin, freqs[i]);
+		fmax = max(fmax, freqs[i]);
+	}
+
+	for (i = 0; i < nr_freqs; i++) {
+		dummy_table[i].index = i;
+		dummy_table[i].frequency = freqs[i];
+		if (nr_volts)
+			dummy_volts[i] = volts[i];
+		else if (fmax == fmin)
+			dummy_volts[i] = 1300;
+		else
+			dummy_volts[i] = 900 + 400 * (freqs[i] - fmin) / (fmax - fmin);
+	}
+	dummy_table[nr_freqs].index = nr_freqs;
+	dummy_table[nr_freqs].frequency = CPUFREQ_TABLE_END;
+	dummy_nstates = nr_freqs;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(dummy_cpu_state, cpu).lock);
+
+	return cpufreq_register_driver(&dummy_cpufreq_driver);
+}
+
+static void __exit dummy_cpufreq_exit(void)
+{
+	cpufreq_unregister_driver(&dummy_cpufreq_driver);
+}
+
+MODULE_DESCRIPTION("Software cpufreq driver with a virtual cycle clock");
+MODULE_LICENSE("GPL");
+
+module_init(dummy_cpufreq_init);
+module_exit(dummy_cpufreq_exit);
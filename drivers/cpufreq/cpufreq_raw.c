@@ -15,6 +15,182 @@
 #include <linux/ktime.h>
 #include <linux/sched.h>
 #include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/math64.h>
+#include <linux/ipipe.h>
+#include <linux/rbtree.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/rcupdate.h>
+#include <linux/preempt.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/cpuidle.h>
+#include <linux/pm_qos_params.h>
+#include <linux/perf_event.h>
+#include <linux/profile.h>
+#include <linux/list.h>
+#include <linux/cpufreq_raw.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_raw.h>
+
+/*
+ * Fila SPSC (produtor unico, consumidor unico) por CPU com os sinais de retorno
+ * de preempcao. O produtor eh wake_up_kworker(), chamado pelo dominio RTAI
+ * (head) na CPU da tarefa; o consumidor eh o RAW MONITOR da politica dessa CPU.
+ * O produtor nunca dorme nem adquire locks: se a fila estiver cheia o sinal eh
+ * descartado e contabilizado em 'dropped'.
+ */
+#define RAW_EVENT_RING_SIZE	32	/* potencia de 2 */
+
+struct raw_event {
+	struct task_struct *task;
+	unsigned long long tick_timer_rtai_ns;
+	unsigned long long deadline_ns;
+	unsigned long long stamp_ns;	/* sched_clock() no momento do sinal */
+};
+
+struct raw_event_ring {
+	unsigned int head;	/* escrito somente pelo produtor */
+	unsigned int tail;	/* escrito somente pelo consumidor */
+	unsigned long dropped;
+	struct raw_event ev[RAW_EVENT_RING_SIZE];
+};
+
+/*
+ * Indice ordenado (crescente) e sem repeticoes das frequencias da politica,
+ * restrito a [policy->min, policy->max]. Reconstruido em GOV_START e em
+ * GOV_LIMITS, e consultado por bissecao a cada decisao do RAW MONITOR.
+ */
+struct raw_freq_index {
+	unsigned int *freq;	/* kHz, ordem crescente */
+	unsigned int count;	/* entradas validas dentro dos limites */
+	unsigned int size;	/* capacidade alocada */
+};
+
+/*
+ * Leitura dos contadores perf de uma tarefa (cpufreq/raw/stall_event): os
+ * totais brutos e, para cada contador, o tempo habilitado e o tempo na PMU.
+ * A escala da multiplexacao so eh aplicada as diferencas de um job.
+ */
+struct raw_stall_sample {
+	u64 cycles;
+	u64 stalls;		/* ciclos parados */
+	u64 cyc_enabled_ns;
+	u64 cyc_running_ns;	/* tempo com o contador de ciclos na PMU */
+	u64 st_enabled_ns;
+	u64 st_running_ns;
+};
+
+/*
+ * Tarefa sinalizada aguardando o fim do job, na fila EDF da politica. O
+ * deadline RTAI eh convertido para a base de tempo local (sched_clock()) no
+ * momento do sinal, para que tarefas sinalizadas em instantes diferentes
+ * possam ser comparadas.
+ */
+struct raw_edf_task {
+	struct rb_node node;
+	struct task_struct *task;
+	unsigned long long deadline_ns;		/* deadline RTAI informado no sinal */
+	unsigned long long local_deadline_ns;	/* mesmo deadline em sched_clock() */
+	unsigned long long tick_ns;		/* tick RTAI do sinal */
+	unsigned long long stamp_ns;		/* sched_clock() do sinal */
+	u64 idle_us_start;			/* tempo ocioso da CPU quando o job entrou na fila */
+	u64 wall_us_start;
+	u64 trans_start;			/* info->transitions quando o job entrou na fila */
+	unsigned int policy;			/* RAW_POLICY_* do bloco de controle */
+	bool perf_valid;			/* aperf/mperf da tarefa no inicio do job */
+	u64 aperf_start;
+	u64 mperf_start;
+	bool stall_valid;			/* contadores perf da tarefa no inicio do job */
+	struct raw_stall_sample stall_start;
+};
+
+/*
+ * Modelo de energia da politica, carregado pelo usuario em cpufreq/raw/energy_model
+ * com uma linha "freq(kHz) tensao(mV) potencia_ativa(mW) potencia_ociosa(mW)"
+ * por estado. Mantido em ordem crescente de frequencia.
+ */
+#define RAW_EM_MAX_STATES	32
+
+struct raw_energy_state {
+	unsigned int freq;
+	unsigned int voltage;
+	unsigned int power_active;
+	unsigned int power_idle;
+};
+
+struct raw_energy_model {
+	unsigned int count;
+	struct raw_energy_state state[RAW_EM_MAX_STATES];
+};
+
+/*
+ * Folga deixada por jobs que terminaram antes do pior caso: o tempo que havia
+ * sido reservado para os ciclos nao usados, valido ate o deadline do job que a
+ * gerou. Mantida em ordem crescente de expiracao.
+ */
+#define RAW_SLACK_MAX	8
+
+struct raw_slack {
+	u64 amount_ns;
+	unsigned long long expires_ns;	/* sched_clock() */
+};
+
+/*
+ * Proxima liberacao prevista de uma tarefa cujo job saiu da fila EDF: com
+ * deadline implicito, o proximo job nao chega antes do deadline do atual.
+ * tolerancia_ns eh quanto o inicio do job pode atrasar (saida de um C-state)
+ * e ainda executar o WCEC na frequencia maxima; < 0 se o periodo for
+ * desconhecido.
+ */
+#define RAW_RELEASE_MAX	8
+
+struct raw_release {
+	unsigned long long release_ns;	/* sched_clock() */
+	s64 tolerancia_ns;
+	int cpu;
+};
+
+/*
+ * Demanda calculada por calc_freq(): o prefixo critico da fila EDF, isto eh,
+ * o que exige a maior frequencia.
+ */
+struct raw_demand {
+	struct raw_edf_task *critica;	/* ultima tarefa do prefixo critico */
+	unsigned long cycles;		/* RWCEC acumulado do prefixo critico */
+	long long time_ns;		/* tempo ate o deadline da tarefa critica */
+	unsigned long total_cycles;	/* RWCEC de toda a fila */
+	long long horizon_ns;		/* tempo ate o ultimo deadline da fila */
+	unsigned int min_freq;		/* maior cpu_frequency_min da fila */
+	bool violado;			/* algum deadline ja passou */
+};
+
+/*
+ * Histograma log2 de latencias (ns): o balde i conta amostras em [2^i, 2^(i+1)).
+ * ewma_ns eh a media movel exponencial (peso 1/8) usada como custo esperado.
+ */
+#define RAW_LAT_BUCKETS	32
+
+/* Modo hibrido: mesmos valores padrao do ondemand */
+#define RAW_HYB_DEF_SAMPLING_RATE	20000	/* us */
+#define RAW_HYB_MIN_SAMPLING_RATE	1000	/* us */
+#define RAW_HYB_DEF_UP_THRESHOLD	80
+#define RAW_HYB_MIN_UP_THRESHOLD	11
+#define RAW_HYB_MAX_UP_THRESHOLD	100
+#define RAW_HYB_DOWN_DIFFERENTIAL	10
+
+struct raw_lat_hist {
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+	u64 ewma_ns;
+	u32 bucket[RAW_LAT_BUCKETS];
+};
 
 struct raw_gov_info_struct {
 	cputime64_t prev_cpu_idle;
@@ -26,9 +202,83 @@ struct raw_gov_info_struct {
 
 	struct mutex timer_mutex;
 
-	struct task_struct *tarefa_sinalizada;
-	unsigned long long deadline_tarefa_sinalizada;
-	unsigned long long tick_timer_rtai_ns;
+	struct raw_freq_index freq_index;
+	struct raw_energy_model energy_model;
+
+	struct raw_event_ring ring;
+
+	/* tarefas sinalizadas, ordenadas por deadline (EDF) */
+	struct rb_root edf_queue;
+	unsigned int edf_count;
+
+	/* Recuperacao dinamica de folga */
+	unsigned int slack_reclaim;	/* tunable sysfs: 0 - desligado, 1 - ligado */
+	unsigned int slack_count;
+	struct raw_slack slack[RAW_SLACK_MAX];
+
+	/* Previsao pelo caso medio (ACEC) com passo para o pior caso */
+	unsigned int acec;		/* tunable sysfs: 0 - desligado, 1 - ligado */
+	struct hrtimer stepup_timer;
+
+	/*
+	 * Intercalacao de duas frequencias: executa em interleave_freq_hi ate
+	 * interleave_switch_ns (ktime_get()) e depois em interleave_freq_lo.
+	 */
+	unsigned int interleave;	/* tunable sysfs: 0 - desligado, 1 - ligado */
+	unsigned int interleave_freq_hi;
+	unsigned int interleave_freq_lo;
+	s64 interleave_switch_ns;
+	struct hrtimer interleave_timer;
+	struct kthread_work interleave_work;
+
+	/* Troca rapida (->fast_switch) no retorno de preempcao */
+	unsigned int fast_switch;	/* tunable sysfs: 0 - desligado, 1 - ligado */
+
+	/*
+	 * Ciclos parados em memoria: evento bruto da PMU (PERF_TYPE_RAW) que
+	 * conta ciclos parados, medido por tarefa a cada job. 0 - desligado.
+	 */
+	u64 stall_event;		/* tunable sysfs */
+
+	/*
+	 * Dicas ao governor do cpuidle: proxima liberacao conhecida de cada CPU
+	 * da politica e a latencia de saida que o job tolera. idle_hint eh o
+	 * pedido da CPU deste info; release[] eh mantido no info da politica.
+	 */
+	unsigned int idle_hints;	/* tunable sysfs: 0 - desligado, 1 - ligado */
+	struct cpuidle_rt_hint idle_hint;
+	unsigned int release_count;
+	struct raw_release release[RAW_RELEASE_MAX];
+
+	/*
+	 * Modo hibrido: um amostrador no estilo do ondemand calcula util_freq pela
+	 * carga da politica e a exigencia das tarefas RT (rt_floor) atua como piso.
+	 * A politica executa em max(rt_floor, util_freq). hyb_prev_* sao por CPU.
+	 */
+	unsigned int hybrid;		/* tunable sysfs: 0 - desligado, 1 - ligado */
+	unsigned int sampling_rate;	/* tunable sysfs: us */
+	unsigned int up_threshold;	/* tunable sysfs: % */
+	unsigned int util_freq;
+	unsigned int rt_floor;
+	cputime64_t hyb_prev_idle;
+	cputime64_t hyb_prev_wall;
+	struct hrtimer sample_timer;
+	struct kthread_work sample_work;
+
+	/*
+	 * Custos medidos: switch_lat entre PRECHANGE e POSTCHANGE de cada troca
+	 * da politica, monitor_lat entre o sinal da tarefa e a troca pedida pelo
+	 * RAW MONITOR. lat_lock porque o notifier roda dentro de ->target().
+	 * Tambem protege as trocas contadas e as estatisticas de deadline.
+	 */
+	spinlock_t lat_lock;
+	u64 switch_start_ns;
+	struct raw_lat_hist switch_lat;
+	struct raw_lat_hist monitor_lat;
+	u64 transitions;
+	struct raw_job_stats job_stats;
+	bool stats_active;		/* listado em debugfs summary (protegido por raw_mutex) */
+	struct dentry *debugfs_file;
 
 	/* Os atributos abaixo indicam o intervalo de tempo que o RAW MONITOR levou para ser ativado. */
 	unsigned long long start_timer_delay_monitor;
@@ -37,44 +287,184 @@ struct raw_gov_info_struct {
 
 static DEFINE_PER_CPU(struct raw_gov_info_struct, raw_gov_info);
 
+/*
+ * Contadores de ciclos da CPU (APERF/MPERF) lidos na ultima troca de contexto
+ * que colocou em execucao uma tarefa com historico (owner).
+ */
+struct raw_perf_snap {
+	struct task_struct *owner;
+	u64 aperf;
+	u64 mperf;
+};
+
+static DEFINE_PER_CPU(struct raw_perf_snap, raw_perf_snap);
+
 static DEFINE_MUTEX(raw_mutex);
 
-struct cpufreq_frequency_table *freq_table;
+/* IRQ virtual usado para acordar o RAW MONITOR a partir do dominio head. */
+static unsigned raw_gov_virq;
+
+/* politicas sob o RAW GOVERNOR; o preempt notifier fica registrado enquanto > 0 (protegido por raw_mutex) */
+static unsigned int raw_gov_active;
 
 #define dprintk(msg...) cpufreq_debug_printk(CPUFREQ_DEBUG_GOVERNOR, "raw", msg)
 
-unsigned int get_max_frequency_table(struct cpufreq_policy *policy)
+/* /sys/kernel/debug/cpufreq_raw/ */
+static struct dentry *raw_debugfs_root;
+
+static int raw_freq_cmp(const void *a, const void *b)
 {
-	//OBS.: as frequencias comecam do MAIOR para o MENOR. Logo a posicao ZERO do vetor possui a maior frequencia.
-	return freq_table[0].frequency;
+	unsigned int fa = *(const unsigned int *)a;
+	unsigned int fb = *(const unsigned int *)b;
+
+	if (fa < fb)
+		return -1;
+	return fa > fb;
 }
 
-unsigned int get_frequency_table_target(struct cpufreq_policy *policy, unsigned int target_freq)
+/**
+ * Reconstroi o indice de frequencias da politica a partir da tabela do driver.
+ * Deve ser chamada com info->timer_mutex e raw_mutex adquiridos.
+ */
+static int raw_freq_index_build(struct raw_freq_index *index, struct cpufreq_policy *policy)
 {
-	unsigned int new_freq;
-	unsigned int i;
+	struct cpufreq_frequency_table *table;
+	unsigned int i, n = 0;
 
-	if (!cpu_online(policy->cpu))
+	table = cpufreq_frequency_get_table(policy->cpu);
+	if (!table)
 		return -EINVAL;
 
-	//OBS.: as frequencias comecam do MAIOR para o MENOR.
-	new_freq = freq_table[0].frequency;
-	for (i = 0; (freq_table[i].frequency != CPUFREQ_TABLE_END); i++) {
-		unsigned int freq = freq_table[i].frequency;
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++)
+		;
+
+	if (i > index->size) {
+		unsigned int *freq = kmalloc(i * sizeof(*freq), GFP_KERNEL);
+		if (!freq)
+			return -ENOMEM;
+		kfree(index->freq);
+		index->freq = freq;
+		index->size = i;
+	}
+
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		unsigned int freq = table[i].frequency;
 
 		if (freq == CPUFREQ_ENTRY_INVALID)
 			continue;
-
 		if ((freq < policy->min) || (freq > policy->max))
 			continue;
+		index->freq[n++] = freq;
+	}
 
-		if (freq < target_freq) {
-			break;
-		}
-		new_freq = freq;
+	sort(index->freq, n, sizeof(*index->freq), raw_freq_cmp, NULL);
+
+	/* remove as frequencias repetidas */
+	if (n) {
+		unsigned int j = 0;
+		for (i = 1; i < n; i++)
+			if (index->freq[i] != index->freq[j])
+				index->freq[++j] = index->freq[i];
+		n = j + 1;
+	}
+	index->count = n;
+
+	dprintk("raw_freq_index_build: cpu %u, %u frequencies [%u..%u] kHz\n",
+		policy->cpu, n, n ? index->freq[0] : 0, n ? index->freq[n - 1] : 0);
+	return 0;
+}
+
+static void raw_freq_index_free(struct raw_freq_index *index)
+{
+	kfree(index->freq);
+	index->freq = NULL;
+	index->count = 0;
+	index->size = 0;
+}
+
+/**
+ * Menor posicao do indice cuja frequencia eh >= target_freq.
+ * Retorna index->count se nenhuma frequencia atende.
+ */
+static unsigned int raw_freq_index_lower_bound(const struct raw_freq_index *index, unsigned int target_freq)
+{
+	unsigned int lo = 0, hi = index->count;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (index->freq[mid] < target_freq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Menor frequencia (kHz) capaz de executar 'cycles' ciclos em 'time_ns' ns,
+ * isto eh, freq * time_ns >= cycles * 10^6. Somente aritmetica inteira: o
+ * teste de cada ponto da bissecao eh uma multiplicacao, sem divisao.
+ * Se nenhuma frequencia atende, retorna a maior frequencia do indice.
+ */
+static unsigned int raw_freq_index_feasible(const struct raw_freq_index *index, u64 cycles, u64 time_ns)
+{
+	unsigned int lo = 0, hi = index->count;
+	u64 demand;
+
+	if (!index->count)
+		return 0;
+
+	/* cycles * 10^6 estouraria 64 bits: nenhuma frequencia real atende. */
+	if (cycles > div_u64(ULLONG_MAX, USEC_PER_SEC))
+		return index->freq[index->count - 1];
+	demand = cycles * USEC_PER_SEC;
+
+	/* limita time_ns para que freq * time_ns nao estoure 64 bits (conservador). */
+	time_ns = min_t(u64, time_ns, div_u64(ULLONG_MAX, index->freq[index->count - 1]));
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if ((u64)index->freq[mid] * time_ns < demand)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	if (lo == index->count)
+		lo--;
+	return index->freq[lo];
+}
+
+unsigned int get_max_frequency_table(struct cpufreq_policy *policy)
+{
+	struct raw_freq_index *index = &per_cpu(raw_gov_info, policy->cpu).freq_index;
+
+	if (!index->count)
+		return policy->max;
+	return index->freq[index->count - 1];
+}
+
+unsigned int get_frequency_table_target(struct cpufreq_policy *policy, unsigned int target_freq)
+{
+	struct raw_freq_index *index;
+	unsigned int new_freq;
+	unsigned int i;
+
+	if (!cpu_online(policy->cpu))
+		return -EINVAL;
 
-	printk("DEBUG:RAWLINSON - RAW GOVERNOR - get_frequency_table_target(%u) kHz for cpu %u => NOVA FREQ(%u kHz)\n", target_freq, policy->cpu, new_freq);
+	index = &per_cpu(raw_gov_info, policy->cpu).freq_index;
+	if (!index->count)
+		return policy->max;
+
+	i = raw_freq_index_lower_bound(index, target_freq);
+	if (i == index->count)
+		i--;
+	new_freq = index->freq[i];
+
+	trace_raw_gov_table_target(policy->cpu, target_freq, new_freq);
+	dprintk("get_frequency_table_target(%u) kHz for cpu %u => NOVA FREQ(%u kHz)\n", target_freq, policy->cpu, new_freq);
 
 	return new_freq;
 }
@@ -96,22 +486,164 @@ static unsigned long get_raw_cpu_idle_time(struct cpufreq_policy *policy)
 	prev_wall_time = info->prev_cpu_wall;
 	cur_idle_time_us = get_cpu_idle_time_us(policy->cpu, &prev_wall_time);
 	idle_time_us = (unsigned long) cputime64_sub(cur_idle_time_us, info->prev_cpu_idle);
-	printk("DEBUG:RAWLINSON - RAW GOVERNOR - get_raw_cpu_idle_time -> IDLE_TIME (%lu) us\n", idle_time_us);
+	dprintk("get_raw_cpu_idle_time -> IDLE_TIME (%lu) us\n", idle_time_us);
 
 	mutex_unlock(&raw_mutex);
 
 	return idle_time_us;
 }
 
+/*
+ * Tempo ocioso acumulado do CPU (us), como get_cpu_idle_time() do ondemand:
+ * sem as estatisticas do NO_HZ, estima pelos contadores do kstat em jiffies.
+ */
+static cputime64_t raw_cpu_idle_time_jiffy(unsigned int cpu, cputime64_t *wall)
+{
+	cputime64_t idle_time;
+	cputime64_t cur_wall_time;
+	cputime64_t busy_time;
+
+	cur_wall_time = jiffies64_to_cputime64(get_jiffies_64());
+	busy_time = cputime64_add(kstat_cpu(cpu).cpustat.user,
+			kstat_cpu(cpu).cpustat.system);
+
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.irq);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.softirq);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.steal);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.nice);
+
+	idle_time = cputime64_sub(cur_wall_time, busy_time);
+	if (wall)
+		*wall = (cputime64_t)jiffies_to_usecs(cur_wall_time);
+
+	return (cputime64_t)jiffies_to_usecs(idle_time);
+}
+
+static cputime64_t raw_cpu_idle_time(unsigned int cpu, cputime64_t *wall)
+{
+	u64 idle_time = get_cpu_idle_time_us(cpu, wall);
+
+	if (idle_time == -1ULL)
+		return raw_cpu_idle_time_jiffy(cpu, wall);
+
+	return idle_time;
+}
+
+static void raw_slack_expire(struct raw_gov_info_struct *info, unsigned long long now)
+{
+	unsigned int i = 0;
+
+	while (i < info->slack_count && (long long)(info->slack[i].expires_ns - now) <= 0)
+		i++;
+	if (i) {
+		info->slack_count -= i;
+		memmove(info->slack, info->slack + i, info->slack_count * sizeof(*info->slack));
+	}
+}
+
+/**
+ * Doa a folga de um job que terminou antes do pior caso: o RWCEC que sobrou,
+ * convertido em tempo na frequencia em que o job executava, pode ser usado
+ * pelo proximo job ate o deadline do job que terminou. So ha folga se a
+ * tarefa baixou o RWCEC em algum checkpoint (como em raw_profile_record());
+ * senao o RWCEC ainda eh o WCEC inteiro e nada sobrou de fato.
+ */
+static void raw_slack_donate(struct raw_gov_info_struct *info, struct raw_edf_task *entry)
+{
+	struct task_struct *task = entry->task;
+	unsigned int freq = task->cpu_frequency ? task->cpu_frequency : info->policy->cur;
+	unsigned long long now = sched_clock();
+	struct raw_slack novo;
+	unsigned int i;
+
+	if (!info->slack_reclaim || !task->rwcec || !freq ||
+	    !task->tsk_wcec || task->rwcec >= task->tsk_wcec ||
+	    task->rwcec > div_u64(ULLONG_MAX, USEC_PER_SEC) ||
+	    (long long)(entry->local_deadline_ns - now) <= 0)
+		return;
+
+	raw_slack_expire(info, now);
+
+	novo.amount_ns = div_u64((u64)task->rwcec * USEC_PER_SEC, freq);
+	novo.expires_ns = entry->local_deadline_ns;
+	novo.amount_ns = min_t(u64, novo.amount_ns, novo.expires_ns - now);
+
+	/* sem espaco: descarta a folga que expira primeiro */
+	if (info->slack_count == RAW_SLACK_MAX) {
+		if ((long long)(novo.expires_ns - info->slack[0].expires_ns) <= 0)
+			return;
+		info->slack_count--;
+		memmove(info->slack, info->slack + 1, info->slack_count * sizeof(*info->slack));
+	}
+
+	for (i = info->slack_count; i > 0 && (long long)(info->slack[i - 1].expires_ns - novo.expires_ns) > 0; i--)
+		info->slack[i] = info->slack[i - 1];
+	info->slack[i] = novo;
+	info->slack_count++;
+
+	dprintk("raw_slack_donate: PID(%d) RWCEC(%lu) => %llu ns ate %llu\n", task->pid, task->rwcec, novo.amount_ns, novo.expires_ns);
+}
+
+/**
+ * Entrega ao job que esta iniciando toda a folga ainda valida. O job recebe
+ * 'freq' calculada pelo seu pior caso, isto eh, o tempo RWCEC / freq; com a
+ * folga ele pode executar o mesmo RWCEC em RWCEC / (tempo + folga).
+ * Deve ser chamada com info->timer_mutex adquirido.
+ *
+ * Limitacao: a folga so vale para a troca feita no checkpoint (set_frequency()).
+ * calc_freq() nao usa este reservatorio: ele refaz a demanda da fila ate cada
+ * deadline, em que o job que terminou ja nao entra, e somar a folga a essas
+ * janelas contaria o mesmo tempo duas vezes. A proxima execucao do monitor
+ * pode portanto subir de novo a frequencia reduzida aqui.
+ */
+static unsigned int raw_slack_reclaim(struct raw_gov_info_struct *info, struct task_struct *task, unsigned int freq)
+{
+	unsigned long long now;
+	u64 demanda, tempo, folga = 0;
+	unsigned int i;
+
+	if (!info->slack_reclaim || !info->slack_count || !task->rwcec || !freq ||
+	    task->rwcec > div_u64(ULLONG_MAX, USEC_PER_SEC))
+		return freq;
+
+	now = sched_clock();
+	raw_slack_expire(info, now);
+	for (i = 0; i < info->slack_count; i++)
+		folga += min_t(u64, info->slack[i].amount_ns, info->slack[i].expires_ns - now);
+	info->slack_count = 0;
+	if (!folga)
+		return freq;
+
+	demanda = (u64)task->rwcec * USEC_PER_SEC;
+	tempo = div_u64(demanda, freq) + folga;
+
+	dprintk("raw_slack_reclaim: PID(%d) folga %llu ns: %u -> %llu kHz\n", task->pid, folga, freq, div64_u64(demanda + tempo - 1, tempo));
+	return max_t(u64, div64_u64(demanda + tempo - 1, tempo), 1);
+}
+
+/**
+ * Aplica o alvo 'freq' das tarefas RT: ele passa a ser o piso RT e, no modo
+ * hibrido, a politica vai para max(rt_floor, util_freq).
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static int raw_rt_target(struct raw_gov_info_struct *info, unsigned int freq)
+{
+	info->rt_floor = freq;
+	if (info->hybrid)
+		freq = max(freq, info->util_freq);
+	return __cpufreq_driver_target(info->policy, freq, CPUFREQ_RELATION_H);
+}
+
 /**
  * Sets the CPU frequency to freq.
  */
 static int set_frequency(struct cpufreq_policy *policy, struct task_struct *task, unsigned int freq)
 {
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
 	unsigned int valid_freq = 0;
 	int ret = -EINVAL;
 
-	mutex_lock(&raw_mutex);
+	mutex_lock(&info->timer_mutex);
 
 	// Se alguma frequencia foi definida... então o monitor não precisa mais verificar a tarefa que foi sinalizada... \o/
 	if(task && task->pid > 0)
@@ -122,36 +654,43 @@ static int set_frequency(struct cpufreq_policy *policy, struct task_struct *task
 
 		/*
 		 * We're safe from concurrent calls to ->target() here
-		 * as we hold the raw_mutex lock. If we were calling
+		 * as we hold the policy's timer_mutex, which the raw
+		 * monitor also holds. If we were calling
 		 * cpufreq_driver_target, a deadlock situation might occur:
-		 * A: cpufreq_set (lock raw_mutex) ->
+		 * A: cpufreq_set (lock timer_mutex) ->
 		 *      cpufreq_driver_target(lock policy->lock)
 		 * B: cpufreq_set_policy(lock policy->lock) ->
 		 *      __cpufreq_governor ->
-		 *         cpufreq_governor_raw (lock raw_mutex)
+		 *         cpufreq_governor_raw (lock timer_mutex)
 		 */
+		freq = raw_slack_reclaim(info, task, freq);
+		/* race-to-idle: decidido pelo job anterior da tarefa (raw_profile_record) */
+		if (task->raw_profile && task->raw_profile->race)
+			freq = policy->max;
 		valid_freq = get_frequency_table_target(policy, freq);
 		if(valid_freq >= task->cpu_frequency_min)
 		{
-			ret = __cpufreq_driver_target(policy, valid_freq, CPUFREQ_RELATION_H);
+			ret = raw_rt_target(info, valid_freq);
 
 			//Atualizando a frequencia da tarefa para uma frequencia valida.
 			task->cpu_frequency = policy->cur; // (KHz)
 
-			printk("DEBUG:RAWLINSON - RAW GOVERNOR - set_frequency(%u) for cpu %u - %u KHz - GOV(%s) -> PID (%d)\n", freq, policy->cpu, policy->cur, policy->governor->name, task->pid);
+			trace_raw_gov_set_frequency(policy->cpu, task->pid, freq, policy->cur);
+			dprintk("set_frequency(%u) for cpu %u - %u KHz - GOV(%s) -> PID (%d)\n", freq, policy->cpu, policy->cur, policy->governor->name, task->pid);
 		}
 		else
 		{
-			ret = __cpufreq_driver_target(policy, task->cpu_frequency_min, CPUFREQ_RELATION_H);
+			ret = raw_rt_target(info, task->cpu_frequency_min);
 
 			//Atualizando a frequencia da tarefa para uma frequencia valida.
 			task->cpu_frequency = policy->cur; // (KHz)
 
-			printk("DEBUG:RAWLINSON - RAW GOVERNOR - set_frequency(%u) - OBS.: FREQUENCIA INVALIDA! PID (%d) [FREQ_ALVO(%u KHz) < FREQ_MIN(%u KHz)] \n", freq, task->pid, valid_freq, task->cpu_frequency_min);
+			trace_raw_gov_set_frequency(policy->cpu, task->pid, freq, policy->cur);
+			dprintk("set_frequency(%u) - OBS.: FREQUENCIA INVALIDA! PID (%d) [FREQ_ALVO(%u KHz) < FREQ_MIN(%u KHz)] \n", freq, task->pid, valid_freq, task->cpu_frequency_min);
 		}
 	}
 
-	mutex_unlock(&raw_mutex);
+	mutex_unlock(&info->timer_mutex);
 	return ret;
 }
 
@@ -160,180 +699,2361 @@ static int set_frequency(struct cpufreq_policy *policy, struct task_struct *task
  */
 static int cpufreq_raw_set(struct cpufreq_policy *policy, unsigned int freq)
 {
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
 	unsigned int valid_freq = 0;
 	int ret = -EINVAL;
 
-	mutex_lock(&raw_mutex);
+	mutex_lock(&info->timer_mutex);
 
 	valid_freq = get_frequency_table_target(policy, freq);
-	ret = __cpufreq_driver_target(policy, valid_freq, CPUFREQ_RELATION_H);
+	ret = raw_rt_target(info, valid_freq);
 
-	printk("DEBUG:RAWLINSON - cpufreq_raw_set(%u) for cpu %u, freq %u kHz\n", freq, policy->cpu, policy->cur);
+	dprintk("cpufreq_raw_set(%u) for cpu %u, freq %u kHz\n", freq, policy->cpu, policy->cur);
 
-	mutex_unlock(&raw_mutex);
+	mutex_unlock(&info->timer_mutex);
 	return ret;
 }
 
-/**
- * SINALIZA PARA O RAW MONITOR QUE O TAREFA PREEMPTADA VOLTOU A EXECUCAO.
- */
-static int wake_up_kworker(struct cpufreq_policy *policy, struct task_struct *task, unsigned long long tick_timer_rtai_ns, unsigned long long deadline_ns)
+static bool raw_event_push(struct raw_event_ring *ring, struct task_struct *task, unsigned long long tick_timer_rtai_ns, unsigned long long deadline_ns)
 {
-	int ret = -EINVAL;
-	struct timespec timespecKernel;
-	struct raw_gov_info_struct *info;
-	unsigned long cur_idle_time_us;
+	unsigned int head = ring->head;
+	struct raw_event *ev;
 
-	info = &per_cpu(raw_gov_info, policy->cpu);
+	if (head - ACCESS_ONCE(ring->tail) >= RAW_EVENT_RING_SIZE) {
+		ring->dropped++;
+		return false;
+	}
 
-	cur_idle_time_us = get_raw_cpu_idle_time(policy);
+	ev = &ring->ev[head & (RAW_EVENT_RING_SIZE - 1)];
+	ev->task = task;
+	ev->tick_timer_rtai_ns = tick_timer_rtai_ns;
+	ev->deadline_ns = deadline_ns;
+	ev->stamp_ns = sched_clock();
 
-	mutex_lock(&info->timer_mutex);
-	if(task && task->pid > 0)
-	{
-		if(info->tarefa_sinalizada && info->tarefa_sinalizada->pid > 0 && info->tarefa_sinalizada->pid == task->pid && info->deadline_tarefa_sinalizada == deadline_ns)
-		{
-			info->tick_timer_rtai_ns = tick_timer_rtai_ns;
-		}
-		else
-		{
-			info->tarefa_sinalizada = task;
-			info->deadline_tarefa_sinalizada = deadline_ns;
-			info->tick_timer_rtai_ns = tick_timer_rtai_ns;
+	/* o registro deve estar visivel antes do novo head */
+	smp_wmb();
+	ring->head = head + 1;
+	return true;
+}
 
-			timespecKernel = current_kernel_time();
-			info->start_timer_delay_monitor = timespecKernel.tv_nsec; //** PEGANDO O TIMER ATUAL DO KERNEL (ns).
+static bool raw_event_pop(struct raw_event_ring *ring, struct raw_event *ev)
+{
+	unsigned int tail = ring->tail;
 
-			flush_kthread_work(&info->work);
-			queue_kthread_work(&info->kraw_worker, &info->work);
+	if (tail == ACCESS_ONCE(ring->head))
+		return false;
 
-			printk("DEBUG:RAWLINSON - RAW GOVERNOR - wake_up_kworker PID (%d) -> Deadline(%llu)\n", info->tarefa_sinalizada->pid, info->deadline_tarefa_sinalizada);
-		}
-	}
-	mutex_unlock(&info->timer_mutex);
-	return ret;
+	/* le o registro somente depois de observar o head */
+	smp_rmb();
+	*ev = ring->ev[tail & (RAW_EVENT_RING_SIZE - 1)];
+
+	/* o registro deve ser consumido antes de liberar a posicao */
+	smp_mb();
+	ring->tail = tail + 1;
+	return true;
 }
 
-static int calc_freq(struct raw_gov_info_struct *info)
+/**
+ * Executado no dominio root (Linux), na CPU que sinalizou, quando o IRQ virtual
+ * eh sincronizado. Enfileira o trabalho do RAW MONITOR da politica; sinais que
+ * chegam enquanto o trabalho ja esta pendente sao agrupados naturalmente.
+ * Roda em contexto de interrupcao, o que o torna visivel ao synchronize_sched()
+ * de raw_gov_cancel_work().
+ */
+static void raw_gov_virq_handler(unsigned int irq, void *cookie)
 {
-	struct timespec timespecKernel;
-	double cpu_frequency_target = 0.0;
-	double tempoRestanteProcessamento = 0.0;
-	long long tempoRestanteProcessamento_ns = 0;
-	long long tick_timer_atual;
-	long long intervalo_tempo_ativacao_monitor;
-	unsigned int valid_freq = 0;
-
-	timespecKernel = current_kernel_time();
-	info->end_timer_delay_monitor = timespecKernel.tv_nsec; //** PEGANDO O TIMER ATUAL DO KERNEL (ns).
-	intervalo_tempo_ativacao_monitor = info->end_timer_delay_monitor - info->start_timer_delay_monitor;
-	tick_timer_atual = info->tick_timer_rtai_ns + intervalo_tempo_ativacao_monitor;
-
-	tempoRestanteProcessamento_ns = info->deadline_tarefa_sinalizada - tick_timer_atual; // ns
-	tempoRestanteProcessamento = tempoRestanteProcessamento_ns / 1000000000.0; // UNIDADE AQUI EH: nanosegundo(s) para segundo(s) (10^9).
-	if(tempoRestanteProcessamento_ns > 0)
-	{
-		cpu_frequency_target = (info->tarefa_sinalizada->rwcec / tempoRestanteProcessamento) ; // Unidade: Ciclos/segundo (a conversao para segundos foi feita acima 10^9)
-		cpu_frequency_target = cpu_frequency_target / 1000.0; // Unidade: Khz (convertendo para de Hz para KHz)
-		valid_freq = get_frequency_table_target(info->policy, cpu_frequency_target);
+	struct cpufreq_policy *policy;
+	struct raw_gov_info_struct *info;
 
-		printk("DEBUG:RAWLINSON - calc_freq - RWCEC(%ld) / TRP(%lld ns) ===> TIMER(%llu) ==> DelayMonitor(%llu) => FREQ(%u) \n", info->tarefa_sinalizada->rwcec, tempoRestanteProcessamento_ns, tick_timer_atual, intervalo_tempo_ativacao_monitor, valid_freq);
-	}
-	else
-	{
-		/* OBS.:
-		 * QUER DIZER QUE O DEADLINE DA TAREFA FOI VIOLADO... ENTAO EH APLICADO A MAIOR FREQUENCIA DO PROCESSADOR...
-		 * PARA NAO ATRASAR A EXECUCAO DAS DEMAIS TAREFAS.
-		 **/
-		valid_freq = get_max_frequency_table(info->policy);
+	policy = per_cpu(raw_gov_info, ipipe_processor_id()).policy;
+	if (!policy)
+		return;
 
-		printk("DEBUG:RAWLINSON - DEADLINE VIOLADO - calc_freq - RWCEC(%ld) / TRP(%lld ns) ===> TIMER(%llu) ==> DelayMonitor(%llu) => FREQ(%u) \n", info->tarefa_sinalizada->rwcec, tempoRestanteProcessamento_ns, tick_timer_atual, intervalo_tempo_ativacao_monitor, valid_freq);
-	}
-	return valid_freq;
+	info = &per_cpu(raw_gov_info, policy->cpu);
+	queue_kthread_work(&info->kraw_worker, &info->work);
 }
 
-static void clear_task_monitor(struct raw_gov_info_struct *info)
+/*
+ * PASSO IMEDIATO NO RETORNO DE PREEMPCAO: a demanda restante da propria
+ * tarefa (RWCEC ate o deadline) eh um limite inferior para a frequencia de
+ * pior caso que o RAW MONITOR vai calcular. Subir ate ela aqui, com as IRQs
+ * de hardware mascaradas, poupa a latencia de ativacao do monitor; descer
+ * continua sendo decisao do monitor. Drivers sem ->fast_switch, ou que nao
+ * podem trocar a partir deste processador, simplesmente recusam.
+ */
+static void raw_fast_stepup(struct cpufreq_policy *policy, struct task_struct *task, unsigned long long tick_timer_rtai_ns, unsigned long long deadline_ns)
 {
-	info->tarefa_sinalizada = NULL;
-	info->deadline_tarefa_sinalizada = 0;
-	info->tick_timer_rtai_ns = 0;
+	u64 janela, freq;
+
+	if (deadline_ns <= tick_timer_rtai_ns || !task->rwcec)
+		return;
+
+	janela = deadline_ns - tick_timer_rtai_ns;
+	freq = div64_u64((u64)task->rwcec * 1000000ULL + janela - 1, janela);
+	if (freq > policy->cur)
+		cpufreq_driver_fast_switch(policy, min_t(u64, freq, policy->max));
 }
 
-void raw_gov_work(struct kthread_work *work)
+/**
+ * SINALIZA PARA O RAW MONITOR QUE O TAREFA PREEMPTADA VOLTOU A EXECUCAO.
+ *
+ * Pode ser chamada a partir do dominio head do I-pipe: nao dorme, nao adquire
+ * locks e nao espera pelo RAW MONITOR.
+ */
+static int wake_up_kworker(struct cpufreq_policy *policy, struct task_struct *task, unsigned long long tick_timer_rtai_ns, unsigned long long deadline_ns)
 {
 	struct raw_gov_info_struct *info;
-	unsigned long target_freq = 0;
+	unsigned long flags;
+	bool queued;
 
-	info = container_of(work, struct raw_gov_info_struct, work);
+	if(!task || task->pid <= 0)
+		return -EINVAL;
 
-	mutex_lock(&info->timer_mutex);
-	if(info->tarefa_sinalizada && info->tarefa_sinalizada->pid > 0)
-	{
-		if(info->tarefa_sinalizada->rwcec > 0)
-		{
-			target_freq = calc_freq(info);
-			if(target_freq < info->tarefa_sinalizada->cpu_frequency_min)
-				target_freq = info->tarefa_sinalizada->cpu_frequency_min;
+	/* mascara as IRQs de hardware: o dominio root e o head nao podem intercalar escritas na mesma fila */
+	local_irq_save_hw(flags);
+	info = &per_cpu(raw_gov_info, ipipe_processor_id());
+
+	/*
+	 * So aceita o sinal numa CPU governada por esta politica: a fila eh
+	 * consumida pelo monitor dela. A verificacao com as IRQs de hardware
+	 * mascaradas fecha a janela com o GOV_STOP (ver raw_gov_cancel_work()).
+	 */
+	if (!policy || info->policy != policy) {
+		local_irq_restore_hw(flags);
+		return -ENODEV;
+	}
 
-			__cpufreq_driver_target(info->policy, target_freq, CPUFREQ_RELATION_H);
-			info->tarefa_sinalizada->cpu_frequency = target_freq; // (KHz) Nova frequencia para a tarefa... visando diminuir o tempo de folga da tarefa.
+	get_task_struct(task);
+	queued = raw_event_push(&info->ring, task, tick_timer_rtai_ns, deadline_ns);
+	if (queued && info->fast_switch)
+		raw_fast_stepup(policy, task, tick_timer_rtai_ns, deadline_ns);
+	local_irq_restore_hw(flags);
 
-			printk("-------------------------------[ RAW MONITOR ]------------------------------\n");
-			printk("DEBUG:RAWLINSON - raw_gov_work(%lu) for cpu %u, freq %u kHz - PID(%d)\n", target_freq, info->policy->cpu, info->policy->cur, info->tarefa_sinalizada->pid);
-		}
+	if (!queued) {
+		put_task_struct(task);
+		return -EBUSY;
+	}
 
-		info->tarefa_sinalizada->flagReturnPreemption = 0;
-		info->tarefa_sinalizada->flagCheckedRawMonitor = 1;
+#ifdef CONFIG_IPIPE
+	ipipe_trigger_irq(raw_gov_virq);
+#else
+	preempt_disable();
+	raw_gov_virq_handler(raw_gov_virq, NULL);
+	preempt_enable();
+#endif
+	return 0;
+}
 
-		clear_task_monitor(info);
+/*
+ * Credita a 'prev' os ciclos (APERF/MPERF) desde que ela entrou no processador.
+ * So le os contadores quando uma das tarefas tem historico, isto eh, ja
+ * concluiu algum job sob o RAW GOVERNOR.
+ */
+static void raw_perf_switch(struct task_struct *prev, struct task_struct *next)
+{
+	struct raw_task_profile *prof = prev->raw_profile;
+	struct raw_perf_snap *snap;
+	u64 aperf, mperf;
+
+	if (!prof && !next->raw_profile)
+		return;
+	if (cpufreq_driver_read_perf(&aperf, &mperf))
+		return;
+
+	snap = &per_cpu(raw_perf_snap, ipipe_processor_id());
+	if (prof && snap->owner == prev) {
+		prof->aperf += aperf - snap->aperf;
+		prof->mperf += mperf - snap->mperf;
 	}
-	mutex_unlock(&info->timer_mutex);
+	snap->owner = next->raw_profile ? next : NULL;
+	snap->aperf = aperf;
+	snap->mperf = mperf;
 }
 
-static void raw_gov_init_work(struct raw_gov_info_struct *info)
+/*
+ * RASTREAMENTO DE PREEMPCAO: chamado pelo escalonador em toda troca de
+ * contexto (inclusive as feitas pelo dominio head) enquanto alguma politica
+ * estiver sob o RAW GOVERNOR. current eh a tarefa que sai do processador.
+ * Roda com as IRQs desabilitadas: apenas atualiza os flags e os contadores
+ * das tarefas.
+ */
+static void raw_sched_out(struct preempt_notifier *notifier, struct task_struct *next)
 {
-	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
-	struct cpumask cpu_rtai = cpumask_of_cpu(CPUID_RTAI);
+	struct task_struct *prev = current;
 
-	info->tarefa_sinalizada = NULL;
-	info->deadline_tarefa_sinalizada = 0;
+	if(prev->pid == next->pid)
+		return;
 
-	init_kthread_worker(&info->kraw_worker);
-	info->kraw_worker.task = kthread_create(kthread_worker_fn, &info->kraw_worker, "raw_monitor/%d", info->policy->cpu);
-	if (IS_ERR(info->kraw_worker.task)) {
-		printk(KERN_ERR "Creation of raw_monitor/%d failed\n", info->policy->cpu);
+	raw_perf_switch(prev, next);
+
+	/* instante em que o job terminou, para a folga (zerado quando o job entra na fila EDF) */
+	if (prev->state_task_period == TASK_PERIOD_FINISHED && !prev->raw_job_end_ns)
+		prev->raw_job_end_ns = sched_clock();
+
+	if(prev->pid > 0 && next->pid > 0 && prev->state == TASK_RUNNING && next->state == TASK_RUNNING) {
+		prev->flagPreemption = 1;
+	}
+	if(next->pid > 0 && next->flagPreemption && next->state == TASK_RUNNING) {
+		if(next->flagCheckedRawMonitor)
+		{
+			next->flagPreemption = 0;
+			next->flagCheckedRawMonitor = 0;
+			next->flagReturnPreemption = 0;
+		}
+		else
+		{
+			next->flagPreemption = 0;
+			next->flagReturnPreemption = 1;
+		}
 	}
-	printk("DEBUG:RAWLINSON - RAW GOVERNOR - raw_gov_init_work -> PID (%d)\n", info->kraw_worker.task->pid);
+}
 
-//	get_task_struct(info->kraw_worker.task);
-	set_cpus_allowed_ptr(info->kraw_worker.task, &cpu_rtai);
-	kthread_bind(info->kraw_worker.task, info->policy->cpu);
+static struct preempt_ops raw_preempt_ops = {
+	.sched_out	= raw_sched_out,
+};
 
-	/* must use the FIFO scheduler as it is realtime sensitive */
-	sched_setscheduler(info->kraw_worker.task, SCHED_FIFO, &param);
+static struct preempt_notifier raw_preempt_notifier;
 
-	init_kthread_work(&info->work, raw_gov_work);
+/* Trocas de frequencia da politica ja notificadas (POSTCHANGE). */
+static u64 raw_transitions(struct raw_gov_info_struct *info)
+{
+	unsigned long flags;
+	u64 n;
 
-	flush_kthread_work(&info->work);
-	queue_kthread_work(&info->kraw_worker, &info->work);
+	spin_lock_irqsave(&info->lat_lock, flags);
+	n = info->transitions;
+	spin_unlock_irqrestore(&info->lat_lock, flags);
+	return n;
 }
 
-static void raw_gov_cancel_work(struct raw_gov_info_struct *info)
+#ifdef CONFIG_PERF_EVENTS
+/*
+ * Contadores perf de uma tarefa: ciclos e o evento de ciclos parados de
+ * cpufreq/raw/stall_event. Os eventos mantem a tarefa viva, por isso sao
+ * liberados quando ela termina (PROFILE_TASK_EXIT), quando o evento da
+ * politica dona muda, quando ela deixa o RAW GOVERNOR e na descarga do
+ * modulo. A dona eh a ultima politica que leu os contadores.
+ * raw_stall_mutex protege a lista e task->raw_profile->stall.
+ */
+struct raw_stall_counter {
+	struct list_head node;
+	struct task_struct *task;
+	struct raw_gov_info_struct *owner;
+	u64 config;
+	struct perf_event *cycles;
+	struct perf_event *stalls;
+};
+
+static LIST_HEAD(raw_stall_list);
+static DEFINE_MUTEX(raw_stall_mutex);
+static bool raw_stall_exit_registered;
+
+static void raw_stall_release(struct raw_stall_counter *sc)
 {
-	/* Kill irq worker */
-	flush_kthread_worker(&info->kraw_worker);
-	kthread_stop(info->kraw_worker.task);
-	printk("DEBUG:RAWLINSON - raw_gov_cancel_work - Removendo o raw_monitor\n");
+	sc->task->raw_profile->stall = NULL;
+	list_del(&sc->node);
+	perf_event_release_kernel(sc->stalls);
+	perf_event_release_kernel(sc->cycles);
+	kfree(sc);
 }
 
+/*
+ * Libera os contadores de 'owner' (de todas as politicas, se NULL) de outro
+ * evento que 'config' (todos, se 0) e os de tarefas mortas.
+ */
+static void raw_stall_release_owned(struct raw_gov_info_struct *owner, u64 config)
+{
+	struct raw_stall_counter *sc, *tmp;
+
+	mutex_lock(&raw_stall_mutex);
+	list_for_each_entry_safe(sc, tmp, &raw_stall_list, node)
+		if (sc->task->exit_state ||
+		    ((!owner || sc->owner == owner) && (!config || sc->config != config)))
+			raw_stall_release(sc);
+	mutex_unlock(&raw_stall_mutex);
+}
+
+static int raw_stall_task_exit(struct notifier_block *nb, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+	struct raw_task_profile *prof = task->raw_profile;
+
+	if (!prof)
+		return NOTIFY_DONE;
+
+	mutex_lock(&raw_stall_mutex);
+	prof->stall_exited = 1;
+	if (prof->stall)
+		raw_stall_release(prof->stall);
+	mutex_unlock(&raw_stall_mutex);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block raw_stall_exit_nb = {
+	.notifier_call = raw_stall_task_exit,
+};
+
+static struct perf_event *raw_stall_event_create(struct task_struct *task, u32 type, u64 config)
+{
+	struct perf_event_attr attr = {
+		.type		= type,
+		.config		= config,
+		.size		= sizeof(attr),
+		.exclude_hv	= 1,
+	};
+
+	return perf_event_create_kernel_counter(&attr, -1, task, NULL);
+}
+
+/* Contadores da tarefa para o evento 'config', criados no primeiro uso. */
+static struct raw_stall_counter *raw_stall_get(struct raw_gov_info_struct *info, struct task_struct *task, u64 config)
+{
+	struct raw_task_profile *prof = task->raw_profile;
+	struct raw_stall_counter *sc = prof->stall, *tmp;
+
+	if (sc && sc->config == config) {
+		/* a tarefa pode ter migrado de politica */
+		sc->owner = info;
+		return sc;
+	}
+	if (sc)
+		raw_stall_release(sc);
+
+	/*
+	 * O notifier de saida pode ter rodado antes do historico existir: nao
+	 * cria contadores para tarefas saindo e recolhe os que ficaram para tras.
+	 */
+	if (prof->stall_exited || (task->flags & PF_EXITING))
+		return NULL;
+	list_for_each_entry_safe(sc, tmp, &raw_stall_list, node)
+		if (sc->task->exit_state)
+			raw_stall_release(sc);
+
+	sc = kzalloc(sizeof(*sc), GFP_KERNEL);
+	if (!sc)
+		return NULL;
+	sc->cycles = raw_stall_event_create(task, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	if (IS_ERR(sc->cycles))
+		goto free;
+	sc->stalls = raw_stall_event_create(task, PERF_TYPE_RAW, config);
+	if (IS_ERR(sc->stalls))
+		goto release;
+
+	sc->task = task;
+	sc->owner = info;
+	sc->config = config;
+	list_add(&sc->node, &raw_stall_list);
+	prof->stall = sc;
+	return sc;
+
+release:
+	perf_event_release_kernel(sc->cycles);
+free:
+	kfree(sc);
+	return NULL;
+}
+
+/**
+ * Le os contadores da tarefa, sem escala: sob multiplexacao a razao entre
+ * tempo habilitado e tempo na PMU muda ao longo da vida da tarefa, entao a
+ * escala so vale para as diferencas de um job (raw_stall_scale()).
+ */
+static int raw_stall_read(struct raw_gov_info_struct *info, struct task_struct *task, struct raw_stall_sample *sample)
+{
+	struct raw_stall_counter *sc;
+	u64 config = info->stall_event;
+	int ret = -ENOENT;
+
+	if (!config || !raw_stall_exit_registered || !task->raw_profile)
+		return -ENOENT;
+
+	mutex_lock(&raw_stall_mutex);
+	sc = raw_stall_get(info, task, config);
+	if (sc) {
+		sample->cycles = perf_event_read_value(sc->cycles, &sample->cyc_enabled_ns,
+						       &sample->cyc_running_ns);
+		sample->stalls = perf_event_read_value(sc->stalls, &sample->st_enabled_ns,
+						       &sample->st_running_ns);
+		ret = 0;
+	}
+	mutex_unlock(&raw_stall_mutex);
+	return ret;
+}
+
+static void raw_stall_init(void)
+{
+	/* sem o notifier de saida os contadores nao seriam liberados: recurso desligado */
+	raw_stall_exit_registered = !profile_event_register(PROFILE_TASK_EXIT, &raw_stall_exit_nb);
+}
+
+static void raw_stall_exit(void)
+{
+	if (!raw_stall_exit_registered)
+		return;
+	profile_event_unregister(PROFILE_TASK_EXIT, &raw_stall_exit_nb);
+	raw_stall_release_owned(NULL, 0);
+}
+#else
+#define raw_stall_exit_registered	false
+static inline void raw_stall_release_owned(struct raw_gov_info_struct *owner, u64 config) { }
+static inline int raw_stall_read(struct raw_gov_info_struct *info, struct task_struct *task, struct raw_stall_sample *sample) { return -ENOENT; }
+static inline void raw_stall_init(void) { }
+static inline void raw_stall_exit(void) { }
+#endif /* CONFIG_PERF_EVENTS */
+
+static struct raw_edf_task *raw_edf_find(struct raw_gov_info_struct *info, struct task_struct *task)
+{
+	struct rb_node *node;
+
+	for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		if (entry->task == task)
+			return entry;
+	}
+	return NULL;
+}
+
+static void raw_edf_insert(struct raw_gov_info_struct *info, struct raw_edf_task *entry)
+{
+	struct rb_node **link = &info->edf_queue.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*link) {
+		struct raw_edf_task *cur = rb_entry(*link, struct raw_edf_task, node);
+
+		parent = *link;
+		if ((long long)(entry->local_deadline_ns - cur->local_deadline_ns) < 0)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&entry->node, parent, link);
+	rb_insert_color(&entry->node, &info->edf_queue);
+	info->edf_count++;
+}
+
+static void raw_edf_remove(struct raw_gov_info_struct *info, struct raw_edf_task *entry)
+{
+	rb_erase(&entry->node, &info->edf_queue);
+	info->edf_count--;
+	put_task_struct(entry->task);
+	kfree(entry);
+}
+
+static void raw_edf_clear(struct raw_gov_info_struct *info)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&info->edf_queue)))
+		raw_edf_remove(info, rb_entry(node, struct raw_edf_task, node));
+}
+
+/**
+ * Insere (ou reposiciona) na fila EDF a tarefa de um sinal. A referencia da
+ * tarefa obtida pelo produtor passa a pertencer a fila.
+ */
+static void raw_edf_enqueue(struct raw_gov_info_struct *info, struct raw_event *ev)
+{
+	struct raw_edf_task *entry;
+
+	entry = raw_edf_find(info, ev->task);
+	if (entry) {
+		put_task_struct(ev->task);
+		rb_erase(&entry->node, &info->edf_queue);
+		info->edf_count--;
+	} else {
+		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+		if (!entry) {
+			put_task_struct(ev->task);
+			return;
+		}
+		entry->task = ev->task;
+		entry->idle_us_start = get_cpu_idle_time_us(task_cpu(ev->task), &entry->wall_us_start);
+		entry->trans_start = raw_transitions(info);
+		entry->policy = RAW_POLICY_STRETCH;
+		entry->perf_valid = ev->task->raw_profile != NULL;
+		if (entry->perf_valid) {
+			entry->aperf_start = ACCESS_ONCE(ev->task->raw_profile->aperf);
+			entry->mperf_start = ACCESS_ONCE(ev->task->raw_profile->mperf);
+		}
+		entry->stall_valid = !raw_stall_read(info, ev->task, &entry->stall_start);
+		ev->task->raw_job_end_ns = 0;
+	}
+
+	entry->deadline_ns = ev->deadline_ns;
+	entry->tick_ns = ev->tick_timer_rtai_ns;
+	entry->stamp_ns = ev->stamp_ns;
+	entry->local_deadline_ns = ev->stamp_ns + (ev->deadline_ns - ev->tick_timer_rtai_ns);
+	raw_edf_insert(info, entry);
+}
+
+/*
+ * Bloco de controle compartilhado (/dev/raw_gov): cada tarefa que abre o
+ * dispositivo recebe uma pagina com uma struct raw_task_ctl, publicada em
+ * task->raw_ctl, onde informa RWCEC, deadline, estado e frequencia minima
+ * com escritas simples protegidas por um seqcount.
+ */
+#define RAW_CTL_READ_RETRIES	16
+
+static int raw_task_ctl_read(struct task_struct *task, struct raw_task_ctl *snap)
+{
+	struct raw_task_ctl *ctl;
+	unsigned int seq, tries = 0;
+	int ret = -ENOENT;
+
+	rcu_read_lock();
+	ctl = rcu_dereference(task->raw_ctl);
+	if (!ctl)
+		goto out;
+
+	ret = -EAGAIN;
+	do {
+		/* a tarefa pode ter sido preemptada no meio de uma escrita */
+		if (++tries > RAW_CTL_READ_RETRIES)
+			goto out;
+		seq = ACCESS_ONCE(ctl->seq);
+		if (seq & 1)
+			continue;
+		smp_rmb();
+		*snap = *ctl;
+		smp_rmb();
+	} while (seq != ACCESS_ONCE(ctl->seq) || (seq & 1));
+
+	ret = (snap->flags & RAW_CTL_VALID) ? 0 : -ENOENT;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/**
+ * Atualiza as tarefas da fila EDF com os valores publicados nos seus blocos de
+ * controle, reposicionando as que informaram um novo deadline.
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static void raw_edf_sync_ctl(struct raw_gov_info_struct *info)
+{
+	struct rb_node *node = rb_first(&info->edf_queue);
+	struct raw_task_ctl snap;
+
+	while (node) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		struct task_struct *task = entry->task;
+
+		node = rb_next(node);
+		if (raw_task_ctl_read(task, &snap))
+			continue;
+
+		task->rwcec = snap.rwcec;
+		task->state_task_period = snap.state;
+		task->cpu_frequency_min = snap.min_freq;
+		entry->policy = snap.policy <= RAW_POLICY_AUTO ? snap.policy : RAW_POLICY_STRETCH;
+
+		if (snap.deadline_ns && snap.deadline_ns != entry->deadline_ns) {
+			rb_erase(&entry->node, &info->edf_queue);
+			info->edf_count--;
+			entry->deadline_ns = snap.deadline_ns;
+			entry->local_deadline_ns = entry->stamp_ns + (snap.deadline_ns - entry->tick_ns);
+			raw_edf_insert(info, entry);
+		}
+	}
+}
+
+#define RAW_PROFILE_MIN_JOBS	4	/* jobs necessarios para usar a previsao */
+
+static struct raw_energy_state *raw_energy_find(struct raw_energy_model *em, unsigned int freq)
+{
+	unsigned int lo = 0, hi = em->count;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (em->state[mid].freq < freq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < em->count && em->state[lo].freq == freq)
+		return &em->state[lo];
+	return NULL;
+}
+
+/*
+ * Sensibilidade a frequencia: ciclos por job limitados a 2^36 no ajuste (com
+ * ate RAW_PROFILE_JOBS produtos de 2^36 * kHz sem estourar um s64), e desvio
+ * padrao minimo das frequencias dos jobs de cpuinfo.max_freq / 20.
+ */
+#define RAW_SENS_MAX_CYCLES	(1ULL << 36)
+#define RAW_SENS_MIN_SPREAD	20
+/* Sem modelo de energia: corre para o ocioso abaixo desta sensibilidade (por mil) */
+#define RAW_RACE_SENSITIVITY	300
+/* Bits fracionarios da razao APERF/MPERF */
+#define RAW_PERF_SHIFT		10
+
+/**
+ * Ajusta ciclos = C + mem_ns * freq / 10^6 (minimos quadrados) sobre os jobs
+ * do historico: jobs limitados pela memoria gastam mais ciclos quanto maior a
+ * frequencia, pois os ciclos parados no acesso a DRAM nao encolhem.
+ */
+static void raw_sens_update(struct raw_task_profile *prof, unsigned int fref)
+{
+	unsigned int i, n = prof->perf_count, shift = 0;
+	u64 soma_f = 0, soma_c = 0, maior = 0;
+	s64 mf, mc, cov = 0, var = 0, spread, mem, comp;
+
+	prof->sensitivity = -1;
+	if (n < RAW_PROFILE_MIN_JOBS || !fref)
+		return;
+
+	for (i = 0; i < n; i++) {
+		soma_f += prof->perf_freq[i];
+		maior = max(maior, prof->perf_cycles[i]);
+	}
+	while ((maior >> shift) > RAW_SENS_MAX_CYCLES)
+		shift++;
+	for (i = 0; i < n; i++)
+		soma_c += prof->perf_cycles[i] >> shift;
+	mf = div_u64(soma_f, n);
+	mc = div_u64(soma_c, n);
+
+	for (i = 0; i < n; i++) {
+		s64 df = (s64)prof->perf_freq[i] - mf;
+		s64 dc = (s64)(prof->perf_cycles[i] >> shift) - mc;
+
+		cov += df * dc;
+		var += df * df;
+	}
+
+	/* jobs em frequencias proximas demais nao separam as duas parcelas */
+	spread = fref / RAW_SENS_MIN_SPREAD;
+	if (var < (s64)n * spread * spread)
+		return;
+
+	/* inclinacao em ciclos por kHz = mem_ns / 10^6 */
+	mem = div64_s64(cov, max_t(s64, div_s64(var, 1000000), 1));
+	if (mem < 0)
+		mem = 0;
+	comp = mc - div_s64(mem * mf, 1000000);
+	if (comp < 0)
+		comp = 0;
+
+	prof->mem_ns = (u64)mem << shift;
+	prof->comp_ns = div_u64((u64)comp * 1000000, fref) << shift;
+	if (prof->comp_ns + prof->mem_ns)
+		prof->sensitivity = div64_u64(prof->comp_ns * 1000, prof->comp_ns + prof->mem_ns);
+}
+
+/* Tempo (ns) do job medio da tarefa executado inteiro em freq. */
+static u64 raw_sens_runtime(struct raw_task_profile *prof, unsigned int fref, unsigned int freq)
+{
+	return div_u64(prof->comp_ns * fref, freq) + prof->mem_ns;
+}
+
+/**
+ * Race-to-idle contra stretch-to-deadline para o job medio da tarefa numa
+ * janela de 'janela' ns. Correr executa na maior frequencia e deixa o resto
+ * da janela no estado ocioso mais economico do modelo; esticar executa em uma
+ * frequencia menor que ainda cabe na janela, ocioso naquela frequencia depois.
+ * Sem modelo de energia, corre se a sensibilidade for baixa: o tempo do job
+ * quase nao diminui com a frequencia e esticar pouco economiza.
+ */
+static bool raw_race_cheaper(struct raw_gov_info_struct *info, struct raw_task_profile *prof, u64 janela)
+{
+	struct raw_energy_model *em = &info->energy_model;
+	struct raw_freq_index *index = &info->freq_index;
+	unsigned int fref = info->policy->cpuinfo.max_freq;
+	struct raw_energy_state *st_max;
+	unsigned int i, ocioso = UINT_MAX;
+	u64 t_race, e_race;
+
+	if (prof->sensitivity < 0 || !index->count || !fref)
+		return false;
+	if (!em->count)
+		return prof->sensitivity < RAW_RACE_SENSITIVITY;
+
+	st_max = raw_energy_find(em, index->freq[index->count - 1]);
+	if (!st_max)
+		return false;
+	t_race = raw_sens_runtime(prof, fref, st_max->freq);
+	if (t_race >= janela)
+		return false;
+
+	for (i = 0; i < em->count; i++)
+		ocioso = min(ocioso, em->state[i].power_idle);
+	e_race = (u64)st_max->power_active * t_race + (u64)ocioso * (janela - t_race);
+
+	for (i = 0; i + 1 < index->count; i++) {
+		struct raw_energy_state *st = raw_energy_find(em, index->freq[i]);
+		u64 t;
+
+		if (!st)
+			continue;
+		t = raw_sens_runtime(prof, fref, st->freq);
+		if (t > janela)
+			continue;
+		if ((u64)st->power_active * t + (u64)st->power_idle * (janela - t) <= e_race)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Registra a frequencia media (APERF/MPERF) e os ciclos reais do job, refaz o
+ * ajuste e escolhe a politica dos proximos jobs da tarefa.
+ */
+static void raw_sens_record(struct raw_gov_info_struct *info, struct raw_edf_task *entry, struct raw_task_profile *prof)
+{
+	unsigned int fref = info->policy->cpuinfo.max_freq;
+	int race;
+	u64 da, dm;
+
+	if (entry->perf_valid) {
+		da = ACCESS_ONCE(prof->aperf) - entry->aperf_start;
+		dm = (ACCESS_ONCE(prof->mperf) - entry->mperf_start) >> RAW_PERF_SHIFT;
+		if (da && dm) {
+			prof->perf_freq[prof->perf_next] = (fref * div64_u64(da, dm)) >> RAW_PERF_SHIFT;
+			prof->perf_cycles[prof->perf_next] = da;
+			prof->perf_next = (prof->perf_next + 1) % RAW_PROFILE_JOBS;
+			if (prof->perf_count < RAW_PROFILE_JOBS)
+				prof->perf_count++;
+			raw_sens_update(prof, fref);
+		}
+	}
+
+	race = entry->policy == RAW_POLICY_RACE ||
+	       (entry->policy == RAW_POLICY_AUTO &&
+		raw_race_cheaper(info, prof, entry->local_deadline_ns - entry->stamp_ns));
+	if (race != prof->race)
+		dprintk("PID(%d) sensibilidade %d/1000 (%llu ns + %llu ns de memoria): %s\n", entry->task->pid, prof->sensitivity, prof->comp_ns, prof->mem_ns, race ? "race-to-idle" : "stretch");
+	prof->race = race;
+}
+
+/*
+ * a * b / c sem estourar 64 bits: b e c sao reduzidos a 32 bits (a razao se
+ * mantem) e a eh dividido antes, de modo que o resto vezes b cabe em 64 bits.
+ */
+static u64 raw_mul_div(u64 a, u64 b, u64 c)
+{
+	u64 q, r;
+
+	while (c > 0xffffffffULL || b > 0xffffffffULL) {
+		b >>= 1;
+		c >>= 1;
+	}
+	if (!c)
+		return 0;
+
+	q = div64_u64(a, c);
+	r = a - q * c;
+	return q * b + div64_u64(r * b, c);
+}
+
+/**
+ * Registra a fracao parada em memoria do job: com S ciclos parados de A ciclos
+ * a uma frequencia media f, os ciclos parados na frequencia maxima fref seriam
+ * S' = S * fref / f, pois o tempo parado nao muda. A fracao registrada eh
+ * S' / (A - S + S'), isto eh, relativa a um RWCEC contado em fref.
+ */
+static void raw_stall_record(struct raw_gov_info_struct *info, struct raw_edf_task *entry, struct raw_task_profile *prof)
+{
+	unsigned int fref = info->policy->cpuinfo.max_freq;
+	struct raw_stall_sample *ini = &entry->stall_start;
+	struct raw_stall_sample fim;
+	u64 ciclos, parados, parados_ref, tempo, st_tempo, freq;
+	unsigned int i, pm;
+
+	if (!entry->stall_valid || !fref || raw_stall_read(info, entry->task, &fim))
+		return;
+	/* contadores recriados durante o job (evento trocado): nada a comparar */
+	if (fim.cycles < ini->cycles || fim.stalls < ini->stalls ||
+	    fim.cyc_enabled_ns < ini->cyc_enabled_ns || fim.st_enabled_ns < ini->st_enabled_ns)
+		return;
+
+	ciclos = fim.cycles - ini->cycles;
+	parados = fim.stalls - ini->stalls;
+	tempo = fim.cyc_running_ns - ini->cyc_running_ns;
+	st_tempo = fim.st_running_ns - ini->st_running_ns;
+	if (!ciclos || !tempo || !st_tempo)
+		return;
+
+	/* kHz = ciclos * 10^6 / ns, no tempo em que os ciclos foram contados; acima de fref so em turbo */
+	freq = min_t(u64, raw_mul_div(ciclos, 1000000, tempo), fref);
+
+	/* cada contador estendido ao tempo habilitado do job */
+	ciclos = raw_mul_div(ciclos, fim.cyc_enabled_ns - ini->cyc_enabled_ns, tempo);
+	parados = raw_mul_div(parados, fim.st_enabled_ns - ini->st_enabled_ns, st_tempo);
+	if (!ciclos)
+		return;
+	parados = min(parados, ciclos);
+
+	if (!freq)
+		return;
+	parados_ref = div64_u64(parados * fref, freq);
+	pm = div64_u64(parados_ref * 1000, ciclos - parados + parados_ref);
+
+	prof->stall_pm[prof->stall_next] = pm;
+	prof->stall_next = (prof->stall_next + 1) % RAW_PROFILE_JOBS;
+	if (prof->stall_count < RAW_PROFILE_JOBS)
+		prof->stall_count++;
+
+	/* a menor fracao observada: o modelo nunca supoe mais memoria do que houve */
+	prof->stall_permille = 0;
+	if (prof->stall_count < RAW_PROFILE_MIN_JOBS)
+		return;
+	prof->stall_permille = 1000;
+	for (i = 0; i < prof->stall_count; i++)
+		prof->stall_permille = min_t(unsigned int, prof->stall_permille, prof->stall_pm[i]);
+}
+
+/**
+ * Registra no historico da tarefa os ciclos consumidos pelo job que terminou.
+ * Se a tarefa atualiza o RWCEC nos checkpoints, os ciclos consumidos sao
+ * WCEC - RWCEC; caso contrario sao estimados pelo tempo em que a CPU nao
+ * ficou ociosa desde que o job entrou na fila, na frequencia atual.
+ */
+static void raw_profile_record(struct raw_gov_info_struct *info, struct raw_edf_task *entry)
+{
+	struct task_struct *task = entry->task;
+	struct raw_task_profile *prof = task->raw_profile;
+	u64 cycles, idle_us, wall_us;
+
+	if (!prof) {
+		prof = kzalloc(sizeof(*prof), GFP_KERNEL);
+		if (!prof)
+			return;
+		prof->sensitivity = -1;
+		/* raw_sched_out() le o ponteiro sem lock */
+		smp_wmb();
+		task->raw_profile = prof;
+	}
+	raw_sens_record(info, entry, prof);
+	raw_stall_record(info, entry, prof);
+
+	if (task->tsk_wcec && task->rwcec < task->tsk_wcec) {
+		cycles = task->tsk_wcec - task->rwcec;
+	} else {
+		idle_us = get_cpu_idle_time_us(task_cpu(task), &wall_us);
+		if (idle_us == -1ULL || entry->idle_us_start == -1ULL)
+			return;
+		wall_us -= entry->wall_us_start;
+		idle_us -= entry->idle_us_start;
+		if (wall_us <= idle_us)
+			return;
+		cycles = div_u64((wall_us - idle_us) * info->policy->cur, USEC_PER_MSEC);
+		if (task->tsk_wcec)
+			cycles = min_t(u64, cycles, task->tsk_wcec);
+	}
+
+	if (prof->count == RAW_PROFILE_JOBS)
+		prof->sum -= prof->cycles[prof->next];
+	else
+		prof->count++;
+	prof->cycles[prof->next] = cycles;
+	prof->sum += cycles;
+	prof->next = (prof->next + 1) % RAW_PROFILE_JOBS;
+}
+
+/**
+ * Ciclos restantes previstos pelo caso medio: media do historico menos o que
+ * o job ja executou, limitado ao RWCEC. Sem historico suficiente, o RWCEC.
+ */
+static unsigned long raw_profile_predict(struct task_struct *task)
+{
+	struct raw_task_profile *prof = task->raw_profile;
+	unsigned long executado, media;
+
+	if (!prof || prof->count < RAW_PROFILE_MIN_JOBS)
+		return task->rwcec;
+
+	media = div_u64(prof->sum, prof->count);
+	executado = (task->tsk_wcec > task->rwcec) ? task->tsk_wcec - task->rwcec : 0;
+	if (media <= executado)
+		return 0;
+	return min(media - executado, task->rwcec);
+}
+
+static void raw_lat_hist_add(struct raw_lat_hist *h, u64 ns)
+{
+	unsigned int b = ns ? min_t(unsigned int, fls64(ns) - 1, RAW_LAT_BUCKETS - 1) : 0;
+
+	h->bucket[b]++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->ewma_ns = h->count++ ? h->ewma_ns - (h->ewma_ns >> 3) + (ns >> 3) : ns;
+}
+
+/**
+ * Tempo (ns) que se espera perder a cada decisao do monitor: a sua propria
+ * ativacao e a troca de frequencia que ele vai pedir. Sem amostras de troca
+ * usa a latencia anunciada pelo driver.
+ */
+static u64 raw_expected_overhead(struct raw_gov_info_struct *info)
+{
+	unsigned long flags;
+	u64 troca, monitor;
+
+	spin_lock_irqsave(&info->lat_lock, flags);
+	troca = info->switch_lat.count ? info->switch_lat.ewma_ns : 0;
+	monitor = info->monitor_lat.ewma_ns;
+	spin_unlock_irqrestore(&info->lat_lock, flags);
+
+	if (!troca && info->policy->cpuinfo.transition_latency != CPUFREQ_ETERNAL)
+		troca = info->policy->cpuinfo.transition_latency;
+	return troca + monitor;
+}
+
+/**
+ * Tolerancia (ns) do proximo job da tarefa ao atraso de inicio: o periodo
+ * estimado menos o WCEC na frequencia maxima e o custo esperado do monitor.
+ * Retorna -1 se o periodo ainda nao for conhecido.
+ */
+static s64 raw_release_tolerance(struct raw_gov_info_struct *info, struct task_struct *task)
+{
+	struct raw_job_stats *st = task->raw_stats;
+	unsigned int fmax = get_max_frequency_table(info->policy);
+	u64 wcec_ns;
+	s64 tolerancia;
+
+	if (!st || !st->period_ns || !fmax)
+		return -1;
+	if (task->tsk_wcec > div_u64(ULLONG_MAX, USEC_PER_SEC))
+		return 0;
+
+	wcec_ns = div_u64((u64)task->tsk_wcec * USEC_PER_SEC, fmax);
+	tolerancia = (s64)st->period_ns - (s64)wcec_ns - (s64)raw_expected_overhead(info);
+	return max_t(s64, tolerancia, 0);
+}
+
+/* Descarta as liberacoes previstas que ja passaram. */
+static void raw_release_expire(struct raw_gov_info_struct *info, unsigned long long now)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < info->release_count; i++)
+		if ((long long)(info->release[i].release_ns - now) > 0)
+			info->release[n++] = info->release[i];
+	info->release_count = n;
+}
+
+/**
+ * Lembra a proxima liberacao da tarefa cujo job saiu da fila. Sem espaco,
+ * substitui a liberacao mais distante, se a nova for anterior.
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static void raw_release_note(struct raw_gov_info_struct *info, struct raw_edf_task *entry)
+{
+	unsigned long long now = sched_clock();
+	unsigned int i, slot;
+
+	if (!info->idle_hints || (long long)(entry->local_deadline_ns - now) <= 0)
+		return;
+
+	raw_release_expire(info, now);
+	if (info->release_count < RAW_RELEASE_MAX) {
+		slot = info->release_count++;
+	} else {
+		slot = 0;
+		for (i = 1; i < RAW_RELEASE_MAX; i++)
+			if ((long long)(info->release[i].release_ns - info->release[slot].release_ns) > 0)
+				slot = i;
+		if ((long long)(entry->local_deadline_ns - info->release[slot].release_ns) >= 0)
+			return;
+	}
+
+	info->release[slot].release_ns = entry->local_deadline_ns;
+	info->release[slot].tolerancia_ns = raw_release_tolerance(info, entry->task);
+	info->release[slot].cpu = task_cpu(entry->task);
+}
+
+static void raw_idle_hint_merge(u64 *wakeup, s64 *tolerancia, unsigned long long release_ns, s64 tol)
+{
+	if (!*wakeup || (long long)(release_ns - *wakeup) < 0)
+		*wakeup = release_ns;
+	if (tol >= 0 && (*tolerancia < 0 || tol < *tolerancia))
+		*tolerancia = tol;
+}
+
+/**
+ * Publica para o cpuidle, em cada CPU da politica, a proxima liberacao
+ * conhecida: o deadline das tarefas na fila (o proximo job nao chega antes
+ * dele) e as liberacoes lembradas dos jobs que ja sairam. A latencia tolerada
+ * eh a menor entre essas tarefas.
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static void raw_idle_hint_publish(struct raw_gov_info_struct *info)
+{
+	unsigned long long now = sched_clock();
+	u64 now_kt = ktime_to_ns(ktime_get());
+	struct rb_node *node;
+	unsigned int i;
+	int j;
+
+	raw_release_expire(info, now);
+
+	for_each_cpu(j, info->policy->cpus) {
+		u64 wakeup = 0;
+		s64 tolerancia = -1;
+
+		for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+			struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+
+			if (task_cpu(entry->task) != j || (long long)(entry->local_deadline_ns - now) <= 0)
+				continue;
+			raw_idle_hint_merge(&wakeup, &tolerancia, entry->local_deadline_ns,
+					    raw_release_tolerance(info, entry->task));
+		}
+		for (i = 0; i < info->release_count; i++)
+			if (info->release[i].cpu == j)
+				raw_idle_hint_merge(&wakeup, &tolerancia, info->release[i].release_ns,
+						    info->release[i].tolerancia_ns);
+
+		/* o cpuidle de j compara com o proprio relogio: a dica vai na base global do ktime */
+		if (wakeup)
+			wakeup = now_kt + (wakeup - now);
+		cpuidle_rt_hint_update(&per_cpu(raw_gov_info, j).idle_hint, wakeup,
+				       tolerancia < 0 ? PM_QOS_DEFAULT_VALUE :
+				       (s32)min_t(s64, div_s64(tolerancia, NSEC_PER_USEC), INT_MAX));
+	}
+}
+
+/* Retira as dicas de todas as CPUs da politica. */
+static void raw_idle_hint_clear(struct raw_gov_info_struct *info)
+{
+	int j;
+
+	info->release_count = 0;
+	for_each_cpu(j, info->policy->cpus)
+		cpuidle_rt_hint_update(&per_cpu(raw_gov_info, j).idle_hint, 0, PM_QOS_DEFAULT_VALUE);
+}
+
+static void raw_job_stats_add(struct raw_job_stats *st, bool completed, s64 slack, u32 changes)
+{
+	if (completed) {
+		if (!st->jobs || slack < st->slack_min)
+			st->slack_min = slack;
+		if (!st->jobs || slack > st->slack_max)
+			st->slack_max = slack;
+		st->slack_sum += slack;
+		st->jobs++;
+	}
+	if (!completed || slack < 0)
+		st->misses++;
+	st->freq_changes += changes;
+	if (changes > st->freq_changes_max)
+		st->freq_changes_max = changes;
+}
+
+/**
+ * Contabiliza o job que saiu da fila: concluido (folga ate o deadline) ou
+ * ainda executando no deadline (perdido). O fim do job eh a primeira troca de
+ * contexto com TASK_PERIOD_FINISHED; tarefas que so informam o estado pelo
+ * bloco de controle usam o instante em que o monitor viu o fim.
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static void raw_job_account(struct raw_gov_info_struct *info, struct raw_edf_task *entry, bool completed)
+{
+	struct task_struct *task = entry->task;
+	struct raw_job_stats *st = task->raw_stats;
+	unsigned long long fim = task->raw_job_end_ns;
+	unsigned long flags;
+	s64 folga = 0;
+	u32 trocas;
+
+	if (completed) {
+		if (!fim || (long long)(fim - entry->stamp_ns) < 0)
+			fim = sched_clock();
+		folga = (long long)(entry->local_deadline_ns - fim);
+	}
+	trocas = raw_transitions(info) - entry->trans_start;
+
+	if (!st) {
+		st = kzalloc(sizeof(*st), GFP_KERNEL);
+		if (st) {
+			/* /proc/<pid>/raw_stats le o ponteiro sem lock */
+			smp_wmb();
+			task->raw_stats = st;
+		}
+	}
+	if (st) {
+		if (st->last_deadline_ns && entry->local_deadline_ns > st->last_deadline_ns)
+			st->period_ns = entry->local_deadline_ns - st->last_deadline_ns;
+		st->last_deadline_ns = entry->local_deadline_ns;
+		raw_job_stats_add(st, completed, folga, trocas);
+	}
+	raw_release_note(info, entry);
+
+	spin_lock_irqsave(&info->lat_lock, flags);
+	raw_job_stats_add(&info->job_stats, completed, folga, trocas);
+	spin_unlock_irqrestore(&info->lat_lock, flags);
+
+	if (!completed || folga < 0)
+		dprintk("DEADLINE VIOLADO - PID(%d) cpu %u folga %lld ns\n", task->pid, info->policy->cpu, folga);
+}
+
+/**
+ * Remove da fila as tarefas que terminaram o job ou o processo, e, se
+ * 'now' != 0, as que ja passaram do deadline.
+ */
+static void raw_edf_prune(struct raw_gov_info_struct *info, unsigned long long now)
+{
+	struct rb_node *node = rb_first(&info->edf_queue);
+
+	while (node) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		struct task_struct *task = entry->task;
+
+		node = rb_next(node);
+		if (!task->exit_state && task->state_task_period == TASK_PERIOD_FINISHED) {
+			raw_profile_record(info, entry);
+			raw_slack_donate(info, entry);
+			raw_job_account(info, entry, true);
+			raw_edf_remove(info, entry);
+		} else if (task->exit_state) {
+			raw_edf_remove(info, entry);
+		} else if (now && (long long)(entry->local_deadline_ns - now) <= 0) {
+			raw_job_account(info, entry, false);
+			raw_edf_remove(info, entry);
+		}
+	}
+}
+
+/* Algum job da fila deve correr na frequencia maxima (race-to-idle)? */
+static bool raw_edf_race(struct raw_gov_info_struct *info)
+{
+	struct rb_node *node;
+
+	for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		struct raw_task_profile *prof = entry->task->raw_profile;
+
+		if (entry->policy == RAW_POLICY_RACE ||
+		    (entry->policy == RAW_POLICY_AUTO && prof && prof->race))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Divide o RWCEC da tarefa pela fracao parada em memoria medida nos jobs
+ * anteriores: devolve os ciclos que escalam com a frequencia e em *mem_ns o
+ * tempo parado, que nao escala (contado na frequencia maxima).
+ */
+static unsigned long raw_stall_split(struct raw_gov_info_struct *info, struct task_struct *task, u64 *mem_ns)
+{
+	struct raw_task_profile *prof = task->raw_profile;
+	unsigned int fref = info->policy->cpuinfo.max_freq;
+	u64 parados;
+
+	*mem_ns = 0;
+	if (!info->stall_event || !prof || !prof->stall_permille || !fref)
+		return task->rwcec;
+
+	parados = div_u64((u64)task->rwcec * prof->stall_permille, 1000);
+	*mem_ns = div_u64(parados * 1000000, fref);
+	return task->rwcec - parados;
+}
+
+/**
+ * Frequencia que atende a demanda agregada da fila EDF: percorrendo as tarefas
+ * em ordem de deadline, a frequencia deve executar a soma dos RWCEC ate cada
+ * deadline, isto eh, max_k (RWCEC_1 + ... + RWCEC_k) / (D_k - agora - custo),
+ * onde custo eh o tempo esperado da troca de frequencia e do proprio monitor.
+ * Com stall_event, a parte parada em memoria de cada RWCEC sai do numerador
+ * e o seu tempo, que nao depende da frequencia, sai do denominador.
+ * Descreve em *demand o prefixo critico e a demanda de toda a fila, ja com o
+ * custo e o tempo parado descontados dos tempos.
+ */
+static int calc_freq(struct raw_gov_info_struct *info, struct raw_demand *demand)
+{
+	struct rb_node *node;
+	unsigned long long agora;
+	unsigned long rwcec_acumulado = 0;
+	u64 parado_acumulado = 0;
+	long long intervalo_tempo_ativacao_monitor;
+	unsigned int valid_freq = 0;
+	u64 custo = raw_expected_overhead(info);
+
+	info->end_timer_delay_monitor = agora = sched_clock(); //** PEGANDO O TIMER ATUAL DO KERNEL (ns).
+	intervalo_tempo_ativacao_monitor = info->end_timer_delay_monitor - info->start_timer_delay_monitor;
+
+	memset(demand, 0, sizeof(*demand));
+	for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		long long restante = entry->local_deadline_ns - agora; // ns
+		unsigned int freq;
+		u64 parado;
+
+		demand->min_freq = max(demand->min_freq, entry->task->cpu_frequency_min);
+		if (!entry->task->rwcec)
+			continue;
+		rwcec_acumulado += raw_stall_split(info, entry->task, &parado);
+		parado_acumulado += parado;
+		demand->total_cycles = rwcec_acumulado;
+		demand->horizon_ns = restante;
+
+		if (restante <= 0) {
+			/* OBS.:
+			 * QUER DIZER QUE O DEADLINE DA TAREFA FOI VIOLADO... ENTAO EH APLICADO A MAIOR FREQUENCIA DO PROCESSADOR...
+			 * PARA NAO ATRASAR A EXECUCAO DAS DEMAIS TAREFAS.
+			 **/
+			demand->violado = true;
+			demand->critica = entry;
+			demand->cycles = rwcec_acumulado;
+			demand->time_ns = restante;
+			valid_freq = get_max_frequency_table(info->policy);
+			break;
+		}
+
+		/* o custo esperado nao fica disponivel para as tarefas; sem tempo util sobra a frequencia maxima */
+		restante = max_t(long long, restante - (long long)(custo + parado_acumulado), 1);
+		demand->horizon_ns = restante;
+
+		/* Menor frequencia (KHz) tal que FREQ * TRP >= RWCEC acumulado (sem ponto flutuante). */
+		freq = raw_freq_index_feasible(&info->freq_index, rwcec_acumulado, restante);
+		if (freq > valid_freq || !demand->critica) {
+			valid_freq = max(valid_freq, freq);
+			demand->critica = entry;
+			demand->cycles = rwcec_acumulado;
+			demand->time_ns = restante;
+		}
+	}
+
+	if (demand->critica) {
+		trace_raw_gov_calc_freq(info->policy->cpu, demand->critica->task->pid, demand->cycles, demand->time_ns, intervalo_tempo_ativacao_monitor, valid_freq, demand->violado);
+		dprintk("%scalc_freq - PID(%d) RWCEC(%lu) / TRP(%lld ns) ==> DelayMonitor(%lld) => FREQ(%u) [%u tarefas]\n", demand->violado ? "DEADLINE VIOLADO - " : "", demand->critica->task->pid, demand->cycles, demand->time_ns, intervalo_tempo_ativacao_monitor, valid_freq, info->edf_count);
+	}
+	return valid_freq;
+}
+
+/**
+ * Energia (mW * ns = pJ) para executar 'cycles' ciclos no estado 'st' e ficar
+ * ocioso nele pelo restante de 'time_ns'.
+ */
+static u64 raw_energy_cost(const struct raw_energy_state *st, u64 cycles, u64 time_ns)
+{
+	u64 busy_ns = div_u64(cycles * USEC_PER_SEC, st->freq);
+
+	if (busy_ns > time_ns)
+		busy_ns = time_ns;
+	return (u64)st->power_active * busy_ns + (u64)st->power_idle * (time_ns - busy_ns);
+}
+
+/**
+ * Entre as frequencias viaveis (>= min_freq), escolhe a de menor energia para
+ * executar o RWCEC de toda a fila e ficar ocioso ate o ultimo deadline.
+ * Sem modelo carregado, a menor frequencia viavel eh mantida.
+ */
+static unsigned int raw_energy_pick(struct raw_gov_info_struct *info, struct raw_demand *demand, unsigned int min_freq)
+{
+	struct raw_energy_model *em = &info->energy_model;
+	struct raw_freq_index *index = &info->freq_index;
+	unsigned int best = min_freq;
+	u64 best_cost = ULLONG_MAX;
+	unsigned int i;
+
+	if (!em->count || demand->violado || demand->horizon_ns <= 0 ||
+	    demand->total_cycles > div_u64(ULLONG_MAX, USEC_PER_SEC))
+		return min_freq;
+
+	for (i = raw_freq_index_lower_bound(index, min_freq); i < index->count; i++) {
+		struct raw_energy_state *st = raw_energy_find(em, index->freq[i]);
+		u64 cost;
+
+		if (!st)
+			continue;
+		cost = raw_energy_cost(st, demand->total_cycles, demand->horizon_ns);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = st->freq;
+		}
+	}
+	return best;
+}
+
+static unsigned int raw_energy_voltage(struct raw_gov_info_struct *info, unsigned int freq)
+{
+	struct raw_energy_state *st = raw_energy_find(&info->energy_model, freq);
+
+	return st ? st->voltage : 0;
+}
+
+/**
+ * Modo look-ahead (ACEC): escolhe a frequencia que atende a demanda prevista
+ * pelo caso medio e calcula ate quando ela pode ser mantida sem comprometer o
+ * pior caso. Executando em freq por t e na maior frequencia fmax depois, cada
+ * prefixo k da fila cumpre seu deadline se
+ *   freq * t + fmax * (D_k - t) >= RWCEC_1..k * 10^6   (kHz * ns)
+ * Retorna o instante (ns a partir de agora) em que o monitor deve reavaliar com
+ * o pior caso, ou 0 se a previsao nao puder ser usada.
+ */
+static u64 raw_acec_plan(struct raw_gov_info_struct *info, unsigned int wc_freq, unsigned int *freq)
+{
+	struct raw_freq_index *index = &info->freq_index;
+	struct rb_node *node;
+	unsigned long long agora = info->end_timer_delay_monitor;
+	unsigned long previsto = 0, pior;
+	unsigned int fmax, f = 0;
+	u64 limite = ULLONG_MAX;
+
+	if (!info->acec || !index->count)
+		return 0;
+	fmax = index->freq[index->count - 1];
+
+	for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		long long restante = entry->local_deadline_ns - agora;
+
+		if (!entry->task->rwcec)
+			continue;
+		if (restante <= 0)
+			return 0;
+		previsto += raw_profile_predict(entry->task);
+		if (previsto)
+			f = max(f, raw_freq_index_feasible(index, previsto, restante));
+	}
+	f = max(f, index->freq[0]);
+	if (f >= wc_freq)
+		return 0;
+
+	/* limite de tempo de cada prefixo, com a demanda acumulada do pior caso */
+	pior = 0;
+	for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+		struct raw_edf_task *entry = rb_entry(node, struct raw_edf_task, node);
+		u64 restante = entry->local_deadline_ns - agora;
+		u64 capacidade, demanda;
+
+		if (!entry->task->rwcec)
+			continue;
+		pior += entry->task->rwcec;
+		if (pior > div_u64(ULLONG_MAX, USEC_PER_SEC))
+			return 0;
+		restante = min_t(u64, restante, div_u64(ULLONG_MAX, fmax));
+		capacidade = (u64)fmax * restante;
+		demanda = (u64)pior * USEC_PER_SEC;
+		if (capacidade <= demanda)
+			return 0;
+		limite = min(limite, div64_u64(capacidade - demanda, fmax - f));
+	}
+
+	/* a subida para fmax tambem leva o tempo de uma transicao */
+	if (limite == ULLONG_MAX || limite <= 2ULL * info->policy->cpuinfo.transition_latency)
+		return 0;
+
+	*freq = f;
+	return limite - info->policy->cpuinfo.transition_latency;
+}
+
+static enum hrtimer_restart raw_stepup_timer_fn(struct hrtimer *timer)
+{
+	struct raw_gov_info_struct *info = container_of(timer, struct raw_gov_info_struct, stepup_timer);
+
+	queue_kthread_work(&info->kraw_worker, &info->work);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * Planeja a intercalacao entre a frequencia da tabela imediatamente abaixo da
+ * ideal (freq_lo) e a escolhida (freq_hi): executa em freq_hi por t1 e em
+ * freq_lo pelo restante do tempo, com t1 tal que
+ *   freq_hi * t1 + freq_lo * (T - t1) = RWCEC * 10^6   (kHz * ns)
+ * o que consome a energia da frequencia ideal e ainda cumpre o deadline.
+ * Executar primeiro em freq_hi mantem atendidos os prefixos com deadline menor.
+ * So eh usado quando o prefixo critico inclui toda a fila, pois depois da troca
+ * nao ha folga garantida para tarefas com deadline posterior.
+ * Retorna o tempo t1 (ns), ou 0 se nao houver intercalacao.
+ */
+static u64 raw_interleave_plan(struct raw_gov_info_struct *info, struct raw_demand *demand, unsigned int freq_hi, unsigned int *freq_lo)
+{
+	struct raw_freq_index *index = &info->freq_index;
+	u64 demanda, baixa, t1;
+	unsigned int i;
+
+	if (!info->interleave || demand->violado || !demand->critica ||
+	    rb_next(&demand->critica->node))
+		return 0;
+
+	i = raw_freq_index_lower_bound(index, freq_hi);
+	if (i == 0 || i == index->count || index->freq[i] != freq_hi)
+		return 0;
+	*freq_lo = index->freq[i - 1];
+	if (*freq_lo < demand->min_freq)
+		return 0;
+
+	if (demand->cycles > div_u64(ULLONG_MAX, USEC_PER_SEC))
+		return 0;
+	demanda = (u64)demand->cycles * USEC_PER_SEC;
+	baixa = (u64)*freq_lo * demand->time_ns;
+	if (baixa >= demanda)
+		return 0;
+
+	t1 = div64_u64(demanda - baixa + (freq_hi - *freq_lo) - 1, freq_hi - *freq_lo);
+
+	/* o trecho em freq_lo precisa compensar o custo de duas transicoes */
+	if (t1 >= demand->time_ns ||
+	    demand->time_ns - t1 < 2ULL * info->policy->cpuinfo.transition_latency)
+		return 0;
+	return t1;
+}
+
+static enum hrtimer_restart raw_interleave_timer_fn(struct hrtimer *timer)
+{
+	struct raw_gov_info_struct *info = container_of(timer, struct raw_gov_info_struct, interleave_timer);
+
+	queue_kthread_work(&info->kraw_worker, &info->interleave_work);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * Executada pelo RAW MONITOR no instante de troca: reduz para freq_lo. Um
+ * trabalho atrasado de um plano anterior eh ignorado pela verificacao do
+ * instante de troca do plano atual.
+ */
+static void raw_interleave_work(struct kthread_work *work)
+{
+	struct raw_gov_info_struct *info = container_of(work, struct raw_gov_info_struct, interleave_work);
+
+	mutex_lock(&info->timer_mutex);
+	if (info->policy && info->interleave_freq_lo &&
+	    ktime_to_ns(ktime_get()) >= info->interleave_switch_ns) {
+		info->rt_floor = info->interleave_freq_lo;
+		if (info->hybrid)
+			__cpufreq_driver_target(info->policy, max(info->interleave_freq_lo, info->util_freq), CPUFREQ_RELATION_L);
+		else
+			__cpufreq_driver_target(info->policy, info->interleave_freq_lo, CPUFREQ_RELATION_L);
+		trace_raw_gov_work(info->policy->cpu, 0, info->interleave_freq_lo, info->policy->cur);
+		dprintk("raw_interleave_work for cpu %u: %u -> %u kHz\n", info->policy->cpu, info->interleave_freq_hi, info->policy->cur);
+		info->interleave_freq_lo = 0;
+	}
+	mutex_unlock(&info->timer_mutex);
+}
+
+/* Deve ser chamada com info->timer_mutex adquirido. */
+static void raw_interleave_cancel(struct raw_gov_info_struct *info)
+{
+	hrtimer_cancel(&info->interleave_timer);
+	info->interleave_freq_hi = 0;
+	info->interleave_freq_lo = 0;
+}
+
+/**
+ * Esvazia as filas de sinais das CPUs da politica, inserindo as tarefas
+ * sinalizadas na fila EDF. Sinais repetidos da mesma tarefa sao agrupados.
+ * Retorna o numero de sinais consumidos.
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static unsigned int raw_gov_drain_events(struct raw_gov_info_struct *info)
+{
+	struct raw_event ev;
+	unsigned int n = 0;
+	int i;
+
+	for_each_cpu(i, info->policy->cpus) {
+		struct raw_event_ring *ring = &per_cpu(raw_gov_info, i).ring;
+
+		while (raw_event_pop(ring, &ev)) {
+			trace_raw_gov_signal(i, ev.task->pid, ev.tick_timer_rtai_ns, ev.deadline_ns);
+
+			ev.task->flagReturnPreemption = 0;
+			ev.task->flagCheckedRawMonitor = 1;
+
+			info->start_timer_delay_monitor = ev.stamp_ns;
+			raw_edf_enqueue(info, &ev);
+			n++;
+		}
+	}
+	return n;
+}
+
+void raw_gov_work(struct kthread_work *work)
+{
+	struct raw_gov_info_struct *info;
+	struct raw_demand demand;
+	struct rb_node *node;
+	unsigned int target_freq = 0;
+	unsigned int freq_lo = 0;
+	unsigned int energy_freq, acec_freq = 0;
+	u64 t1 = 0, stepup;
+	unsigned long flags;
+	unsigned int sinais;
+	bool race;
+
+	info = container_of(work, struct raw_gov_info_struct, work);
+
+	mutex_lock(&info->timer_mutex);
+	if (!info->policy)
+		goto out;
+
+	sinais = raw_gov_drain_events(info);
+	raw_edf_sync_ctl(info);
+	raw_edf_prune(info, 0);
+
+	/* sem jobs pendentes, o modo hibrido segue apenas a utilizacao */
+	if (!info->edf_count)
+		info->rt_floor = 0;
+
+	if (info->edf_count) {
+		target_freq = calc_freq(info, &demand);
+		if (target_freq) {
+			if(target_freq < demand.min_freq)
+				target_freq = demand.min_freq;
+
+			raw_interleave_cancel(info);
+			hrtimer_cancel(&info->stepup_timer);
+
+			race = raw_edf_race(info);
+			stepup = race ? 0 : raw_acec_plan(info, target_freq, &acec_freq);
+			if (stepup && max(acec_freq, demand.min_freq) >= target_freq)
+				stepup = 0;
+
+			if (race) {
+				/* race-to-idle: frequencia maxima enquanto houver um job que corre na fila */
+				target_freq = get_max_frequency_table(info->policy);
+			} else if (stepup) {
+				/* caso medio agora; o monitor reavalia com o pior caso em 'stepup' ns */
+				target_freq = max(acec_freq, demand.min_freq);
+				hrtimer_start(&info->stepup_timer, ns_to_ktime(stepup), HRTIMER_MODE_REL);
+			} else {
+				energy_freq = raw_energy_pick(info, &demand, target_freq);
+				if (energy_freq > target_freq)
+					target_freq = energy_freq;
+				else
+					t1 = raw_interleave_plan(info, &demand, target_freq, &freq_lo);
+			}
+
+			/* custo do monitor: do sinal mais recente ate a troca pedida */
+			if (sinais && info->end_timer_delay_monitor > info->start_timer_delay_monitor) {
+				spin_lock_irqsave(&info->lat_lock, flags);
+				raw_lat_hist_add(&info->monitor_lat, sched_clock() - info->start_timer_delay_monitor);
+				spin_unlock_irqrestore(&info->lat_lock, flags);
+			}
+
+			raw_rt_target(info, target_freq);
+
+			if (t1) {
+				info->interleave_freq_hi = target_freq;
+				info->interleave_freq_lo = freq_lo;
+				info->interleave_switch_ns = ktime_to_ns(ktime_get()) + t1;
+				hrtimer_start(&info->interleave_timer, ns_to_ktime(t1), HRTIMER_MODE_REL);
+			}
+
+			// (KHz) Nova frequencia para as tarefas... visando diminuir o tempo de folga das tarefas.
+			// Com intercalacao, last_cpu_frequency guarda a frequencia baixa do par planejado.
+			for (node = rb_first(&info->edf_queue); node; node = rb_next(node)) {
+				struct task_struct *task = rb_entry(node, struct raw_edf_task, node)->task;
+
+				task->cpu_frequency = target_freq;
+				task->cpu_voltage = raw_energy_voltage(info, target_freq);
+				if (t1) {
+					task->last_cpu_frequency = freq_lo;
+					task->last_cpu_voltage = raw_energy_voltage(info, freq_lo);
+				}
+			}
+
+			trace_raw_gov_work(info->policy->cpu, rb_entry(rb_first(&info->edf_queue), struct raw_edf_task, node)->task->pid, target_freq, info->policy->cur);
+			dprintk("raw_gov_work(%u) for cpu %u, freq %u kHz - %u tarefas - intercalacao (%u kHz em %llu ns)\n", target_freq, info->policy->cpu, info->policy->cur, info->edf_count, freq_lo, t1);
+		}
+
+		/* os jobs cujo deadline ja passou nao restringem mais a frequencia */
+		raw_edf_prune(info, info->end_timer_delay_monitor);
+	}
+
+	if (info->idle_hints)
+		raw_idle_hint_publish(info);
+out:
+	mutex_unlock(&info->timer_mutex);
+}
+
+/**
+ * Modo hibrido: frequencia pela utilizacao, com o algoritmo de dbs_check_cpu()
+ * do ondemand. A carga eh medida em relacao a frequencia corrente, que pode
+ * estar elevada pelo piso RT; acima de up_threshold vai para policy->max,
+ * abaixo de up_threshold - RAW_HYB_DOWN_DIFFERENTIAL vai para a menor
+ * frequencia que sustenta a carga e, entre os dois, mantem a anterior.
+ * Deve ser chamada com info->timer_mutex adquirido.
+ */
+static unsigned int raw_hybrid_util_freq(struct raw_gov_info_struct *info)
+{
+	struct cpufreq_policy *policy = info->policy;
+	unsigned int max_load_freq = 0;
+	unsigned int freq_next;
+	unsigned int j;
+
+	for_each_cpu(j, policy->cpus) {
+		struct raw_gov_info_struct *j_info = &per_cpu(raw_gov_info, j);
+		cputime64_t cur_wall_time, cur_idle_time;
+		unsigned int idle_time, wall_time;
+		unsigned int load, load_freq;
+		int freq_avg;
+
+		cur_idle_time = raw_cpu_idle_time(j, &cur_wall_time);
+
+		wall_time = (unsigned int) cputime64_sub(cur_wall_time, j_info->hyb_prev_wall);
+		j_info->hyb_prev_wall = cur_wall_time;
+
+		idle_time = (unsigned int) cputime64_sub(cur_idle_time, j_info->hyb_prev_idle);
+		j_info->hyb_prev_idle = cur_idle_time;
+
+		if (unlikely(!wall_time || wall_time < idle_time))
+			continue;
+
+		load = 100 * (wall_time - idle_time) / wall_time;
+
+		freq_avg = __cpufreq_driver_getavg(policy, j);
+		if (freq_avg <= 0)
+			freq_avg = policy->cur;
+
+		load_freq = load * freq_avg;
+		if (load_freq > max_load_freq)
+			max_load_freq = load_freq;
+	}
+
+	if (max_load_freq > info->up_threshold * policy->cur)
+		return policy->max;
+
+	if (max_load_freq < (info->up_threshold - RAW_HYB_DOWN_DIFFERENTIAL) * policy->cur) {
+		freq_next = max_load_freq / (info->up_threshold - RAW_HYB_DOWN_DIFFERENTIAL);
+		return max(freq_next, policy->min);
+	}
+
+	/*
+	 * Mantem o alvo anterior de utilizacao, nunca policy->cur: ela pode
+	 * incluir o piso RT, que passaria a realimentar util_freq. Na primeira
+	 * amostra, a menor frequencia que deixa a carga abaixo de up_threshold.
+	 */
+	if (info->util_freq)
+		return info->util_freq;
+	return max(max_load_freq / info->up_threshold, policy->min);
+}
+
+/* Inicia uma nova janela de amostragem para todos os CPUs da politica. */
+static void raw_hybrid_reset(struct raw_gov_info_struct *info)
+{
+	unsigned int j;
+
+	for_each_cpu(j, info->policy->cpus) {
+		struct raw_gov_info_struct *j_info = &per_cpu(raw_gov_info, j);
+
+		j_info->hyb_prev_idle = raw_cpu_idle_time(j, &j_info->hyb_prev_wall);
+	}
+	info->util_freq = 0;
+}
+
+static enum hrtimer_restart raw_sample_timer_fn(struct hrtimer *timer)
+{
+	struct raw_gov_info_struct *info = container_of(timer, struct raw_gov_info_struct, sample_timer);
+
+	queue_kthread_work(&info->kraw_worker, &info->sample_work);
+	if (!ACCESS_ONCE(info->hybrid))
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime((u64)ACCESS_ONCE(info->sampling_rate) * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/**
+ * Amostragem do modo hibrido, executada pelo RAW MONITOR: a politica vai para
+ * max(rt_floor, util_freq). Fora do modo hibrido nao faz nada.
+ */
+static void raw_sample_work(struct kthread_work *work)
+{
+	struct raw_gov_info_struct *info = container_of(work, struct raw_gov_info_struct, sample_work);
+	unsigned int target_freq;
+
+	mutex_lock(&info->timer_mutex);
+	if (!info->policy || !info->hybrid)
+		goto out;
+
+	info->util_freq = raw_hybrid_util_freq(info);
+	target_freq = max(info->util_freq, info->rt_floor);
+
+	__cpufreq_driver_target(info->policy, target_freq, CPUFREQ_RELATION_H);
+
+	dprintk("raw_sample_work for cpu %u: util %u kHz, piso RT %u kHz -> %u kHz\n", info->policy->cpu, info->util_freq, info->rt_floor, info->policy->cur);
+out:
+	mutex_unlock(&info->timer_mutex);
+}
+
+/**
+ * Cria o RAW MONITOR da politica. O monitor fica restrito as CPUs da politica:
+ * com um unico CPU ele eh fixado nele; num dominio de clock compartilhado ele
+ * pode executar em qualquer CPU do dominio, pois todas mudam juntas.
+ * A politica so eh publicada nas CPUs afetadas depois que o monitor esta
+ * executando: a partir dai sinais, IRQ virtual e timers enfileiram trabalho.
+ */
+static int raw_gov_init_work(struct raw_gov_info_struct *info, struct cpufreq_policy *policy)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	struct task_struct *task;
+	int i;
+
+	info->edf_queue = RB_ROOT;
+	info->edf_count = 0;
+	info->slack_count = 0;
+
+	init_kthread_worker(&info->kraw_worker);
+	task = kthread_create(kthread_worker_fn, &info->kraw_worker, "raw_monitor/%d", policy->cpu);
+	if (IS_ERR(task)) {
+		printk(KERN_ERR "Creation of raw_monitor/%d failed\n", policy->cpu);
+		return PTR_ERR(task);
+	}
+	info->kraw_worker.task = task;
+	dprintk("raw_gov_init_work -> PID (%d)\n", task->pid);
+
+	if (cpumask_weight(policy->cpus) == 1)
+		kthread_bind(task, policy->cpu);
+	else
+		set_cpus_allowed_ptr(task, policy->cpus);
+
+	/* must use the FIFO scheduler as it is realtime sensitive */
+	sched_setscheduler(info->kraw_worker.task, SCHED_FIFO, &param);
+
+	init_kthread_work(&info->work, raw_gov_work);
+	init_kthread_work(&info->interleave_work, raw_interleave_work);
+	hrtimer_init(&info->interleave_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	info->interleave_timer.function = raw_interleave_timer_fn;
+	hrtimer_init(&info->stepup_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	info->stepup_timer.function = raw_stepup_timer_fn;
+	info->interleave_freq_hi = 0;
+	info->interleave_freq_lo = 0;
+
+	init_kthread_work(&info->sample_work, raw_sample_work);
+	hrtimer_init(&info->sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	info->sample_timer.function = raw_sample_timer_fn;
+	info->rt_floor = 0;
+
+	wake_up_process(task);
+
+	mutex_lock(&raw_mutex);
+	for_each_cpu(i, policy->cpus)
+		per_cpu(raw_gov_info, i).policy = policy;
+	mutex_unlock(&raw_mutex);
+
+	if (info->hybrid) {
+		raw_hybrid_reset(info);
+		hrtimer_start(&info->sample_timer, ns_to_ktime((u64)info->sampling_rate * NSEC_PER_USEC), HRTIMER_MODE_REL);
+	}
+
+	flush_kthread_work(&info->work);
+	queue_kthread_work(&info->kraw_worker, &info->work);
+	return 0;
+}
+
+/**
+ * Descarta os sinais das CPUs que nao estao sob nenhuma politica RAW: nenhum
+ * monitor vai consumi-los, e cada um segura uma referencia da tarefa.
+ * Deve ser chamada com raw_mutex adquirido, que serializa a publicacao.
+ */
+static void raw_gov_drain_orphans(void)
+{
+	struct raw_gov_info_struct *j_info;
+	struct raw_event ev;
+	int i;
+
+	for_each_possible_cpu(i) {
+		j_info = &per_cpu(raw_gov_info, i);
+		if (j_info->policy)
+			continue;
+		while (raw_event_pop(&j_info->ring, &ev))
+			put_task_struct(ev.task);
+	}
+}
+
+/**
+ * Desfaz raw_gov_init_work() na ordem inversa: retira a politica das CPUs,
+ * espera os produtores em andamento, cancela os timers e so entao para o
+ * RAW MONITOR, que nao pode mais receber trabalho.
+ */
+static void raw_gov_cancel_work(struct raw_gov_info_struct *info, struct cpufreq_policy *policy)
+{
+#ifdef CONFIG_IPIPE
+	unsigned long flags;
+#endif
+	int i;
+
+	/* com o timer_mutex, os trabalhos em andamento terminam antes e os seguintes nao rearmam timers */
+	mutex_lock(&info->timer_mutex);
+	mutex_lock(&raw_mutex);
+	for_each_cpu(i, policy->cpus)
+		per_cpu(raw_gov_info, i).policy = NULL;
+	mutex_unlock(&raw_mutex);
+	mutex_unlock(&info->timer_mutex);
+
+	/*
+	 * wake_up_kworker() testa a politica com as IRQs de hardware mascaradas,
+	 * inclusive no dominio head: a secao critica do I-pipe so eh obtida
+	 * quando todas as CPUs sairam desses trechos. O tratador da IRQ virtual
+	 * roda em contexto de interrupcao do root, coberto pelo synchronize_sched().
+	 */
+#ifdef CONFIG_IPIPE
+	flags = ipipe_critical_enter(NULL);
+	ipipe_critical_exit(flags);
+#endif
+	synchronize_sched();
+
+	hrtimer_cancel(&info->interleave_timer);
+	hrtimer_cancel(&info->stepup_timer);
+	hrtimer_cancel(&info->sample_timer);
+
+	/* Kill irq worker */
+	flush_kthread_worker(&info->kraw_worker);
+	kthread_stop(info->kraw_worker.task);
+
+	/* descarta os sinais que chegaram apos o ultimo trabalho */
+	mutex_lock(&raw_mutex);
+	raw_gov_drain_orphans();
+	mutex_unlock(&raw_mutex);
+	raw_edf_clear(info);
+	dprintk("raw_gov_cancel_work - Removendo o raw_monitor\n");
+}
+
+/************************** /dev/raw_gov ************************/
+
+struct raw_ctl_file {
+	struct raw_task_ctl *ctl;
+	struct task_struct *task;
+};
+
+static int raw_ctl_open(struct inode *inode, struct file *file)
+{
+	struct raw_ctl_file *f;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	f->ctl = (struct raw_task_ctl *)get_zeroed_page(GFP_KERNEL);
+	if (!f->ctl) {
+		kfree(f);
+		return -ENOMEM;
+	}
+	f->ctl->version = RAW_CTL_VERSION;
+
+	/* um bloco de controle por tarefa */
+	if (cmpxchg(&current->raw_ctl, NULL, f->ctl) != NULL) {
+		free_page((unsigned long)f->ctl);
+		kfree(f);
+		return -EBUSY;
+	}
+
+	get_task_struct(current);
+	f->task = current;
+	file->private_data = f;
+	return 0;
+}
+
+static int raw_ctl_release(struct inode *inode, struct file *file)
+{
+	struct raw_ctl_file *f = file->private_data;
+
+	if (f->task->raw_ctl == f->ctl) {
+		rcu_assign_pointer(f->task->raw_ctl, NULL);
+		/* espera os leitores do RAW MONITOR */
+		synchronize_rcu();
+	}
+
+	put_task_struct(f->task);
+	free_page((unsigned long)f->ctl);
+	kfree(f);
+	return 0;
+}
+
+static int raw_ctl_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct raw_ctl_file *f = file->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTCOPY;
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(f->ctl));
+}
+
+static const struct file_operations raw_ctl_fops = {
+	.owner		= THIS_MODULE,
+	.open		= raw_ctl_open,
+	.release	= raw_ctl_release,
+	.mmap		= raw_ctl_mmap,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice raw_ctl_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "raw_gov",
+	.fops		= &raw_ctl_fops,
+};
+
+/************************** sysfs interface ************************/
+
+/* Tunables do governor 'raw', por politica, em cpufreq/raw/ */
+#define show_one(file_name, object)					\
+static ssize_t show_##file_name						\
+(struct cpufreq_policy *policy, char *buf)				\
+{									\
+	return sprintf(buf, "%u\n",					\
+		       per_cpu(raw_gov_info, policy->cpu).object);	\
+}
+show_one(interleave, interleave);
+show_one(acec, acec);
+show_one(slack_reclaim, slack_reclaim);
+show_one(fast_switch, fast_switch);
+show_one(hybrid, hybrid);
+show_one(sampling_rate, sampling_rate);
+show_one(up_threshold, up_threshold);
+show_one(idle_hints, idle_hints);
+
+static ssize_t store_interleave(struct cpufreq_policy *policy,
+				const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->interleave = !!input;
+	if (!info->interleave)
+		raw_interleave_cancel(info);
+	mutex_unlock(&info->timer_mutex);
+
+	return count;
+}
+
+static int raw_energy_cmp(const void *a, const void *b)
+{
+	return raw_freq_cmp(&((const struct raw_energy_state *)a)->freq,
+			    &((const struct raw_energy_state *)b)->freq);
+}
+
+static ssize_t show_energy_model(struct cpufreq_policy *policy, char *buf)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	struct raw_energy_model *em = &info->energy_model;
+	ssize_t len = 0;
+	unsigned int i;
+
+	mutex_lock(&info->timer_mutex);
+	for (i = 0; i < em->count; i++)
+		len += sprintf(buf + len, "%u %u %u %u\n", em->state[i].freq,
+			       em->state[i].voltage, em->state[i].power_active,
+			       em->state[i].power_idle);
+	mutex_unlock(&info->timer_mutex);
+
+	return len;
+}
+
+/*
+ * Substitui o modelo de energia da politica. Cada linha descreve um estado:
+ * "freq(kHz) tensao(mV) potencia_ativa(mW) potencia_ociosa(mW)". Uma escrita
+ * sem estados remove o modelo.
+ */
+static ssize_t store_energy_model(struct cpufreq_policy *policy,
+				  const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	struct raw_energy_model *em;
+	const char *p = buf;
+	unsigned int n = 0;
+	int consumed;
+
+	em = kzalloc(sizeof(*em), GFP_KERNEL);
+	if (!em)
+		return -ENOMEM;
+
+	while (n < RAW_EM_MAX_STATES) {
+		struct raw_energy_state *st = &em->state[n];
+
+		consumed = -1;
+		if (sscanf(p, "%u %u %u %u%n", &st->freq, &st->voltage,
+			   &st->power_active, &st->power_idle, &consumed) != 4)
+			break;
+		if (!st->freq) {
+			kfree(em);
+			return -EINVAL;
+		}
+		/* o vsscanf para no fim da entrada antes do %n: a ultima linha sem '\n' consumiu o resto */
+		p += consumed < 0 ? strlen(p) : consumed;
+		n++;
+	}
+	p = skip_spaces(p);
+	if (*p) {
+		/* linha invalida ou estados demais */
+		kfree(em);
+		return -EINVAL;
+	}
+
+	em->count = n;
+	sort(em->state, n, sizeof(*em->state), raw_energy_cmp, NULL);
+
+	mutex_lock(&info->timer_mutex);
+	info->energy_model = *em;
+	mutex_unlock(&info->timer_mutex);
+
+	kfree(em);
+	return count;
+}
+
+static ssize_t store_acec(struct cpufreq_policy *policy,
+			  const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->acec = !!input;
+	mutex_unlock(&info->timer_mutex);
+
+	/* sem a previsao, volta imediatamente ao pior caso */
+	if (!input)
+		queue_kthread_work(&info->kraw_worker, &info->work);
+
+	return count;
+}
+
+static ssize_t store_slack_reclaim(struct cpufreq_policy *policy,
+				   const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->slack_reclaim = !!input;
+	info->slack_count = 0;
+	mutex_unlock(&info->timer_mutex);
+
+	return count;
+}
+
+static ssize_t store_fast_switch(struct cpufreq_policy *policy,
+				 const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->fast_switch = !!input;
+	mutex_unlock(&info->timer_mutex);
+
+	return count;
+}
+
+/*
+ * Liga/desliga o modo hibrido. Ao ligar, a janela de amostragem recomeca;
+ * ao desligar, o RAW MONITOR reavalia a fila EDF sem o alvo de utilizacao.
+ */
+static ssize_t store_hybrid(struct cpufreq_policy *policy,
+			    const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	if (!!input == info->hybrid) {
+		mutex_unlock(&info->timer_mutex);
+		return count;
+	}
+	info->hybrid = !!input;
+	if (info->hybrid) {
+		raw_hybrid_reset(info);
+		hrtimer_start(&info->sample_timer, ns_to_ktime((u64)info->sampling_rate * NSEC_PER_USEC), HRTIMER_MODE_REL);
+	} else {
+		hrtimer_cancel(&info->sample_timer);
+		info->util_freq = 0;
+	}
+	mutex_unlock(&info->timer_mutex);
+
+	if (!input)
+		queue_kthread_work(&info->kraw_worker, &info->work);
+
+	return count;
+}
+
+static ssize_t store_sampling_rate(struct cpufreq_policy *policy,
+				   const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->sampling_rate = max_t(unsigned int, input, RAW_HYB_MIN_SAMPLING_RATE);
+	mutex_unlock(&info->timer_mutex);
+
+	return count;
+}
+
+static ssize_t store_up_threshold(struct cpufreq_policy *policy,
+				  const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1 || input > RAW_HYB_MAX_UP_THRESHOLD ||
+			input < RAW_HYB_MIN_UP_THRESHOLD)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->up_threshold = input;
+	mutex_unlock(&info->timer_mutex);
+
+	return count;
+}
+
+/*
+ * Liga/desliga as dicas ao cpuidle. Ao desligar, as CPUs da politica voltam
+ * a ser governadas apenas pelo pm_qos; ao ligar, o RAW MONITOR publica na
+ * proxima ativacao.
+ */
+static ssize_t store_idle_hints(struct cpufreq_policy *policy,
+				const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&info->timer_mutex);
+	info->idle_hints = !!input;
+	if (!info->idle_hints)
+		raw_idle_hint_clear(info);
+	mutex_unlock(&info->timer_mutex);
+
+	if (input)
+		queue_kthread_work(&info->kraw_worker, &info->work);
+
+	return count;
+}
+
+static ssize_t show_stall_event(struct cpufreq_policy *policy, char *buf)
+{
+	return sprintf(buf, "0x%llx\n", per_cpu(raw_gov_info, policy->cpu).stall_event);
+}
+
+/**
+ * cpufreq/raw/stall_event: codigo bruto (PERF_TYPE_RAW) de um evento da PMU
+ * que conta ciclos parados em memoria, por exemplo 0x01a2 (RESOURCE_STALLS.ANY)
+ * em processadores Intel Core. 0 desliga a divisao do RWCEC.
+ */
+static ssize_t store_stall_event(struct cpufreq_policy *policy,
+				 const char *buf, size_t count)
+{
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, policy->cpu);
+	unsigned long long input;
+	int ret;
+
+	ret = strict_strtoull(strstrip((char *)buf), 0, &input);
+	if (ret)
+		return -EINVAL;
+	if (input && !raw_stall_exit_registered)
+		return -ENODEV;
+
+	mutex_lock(&info->timer_mutex);
+	info->stall_event = input;
+	mutex_unlock(&info->timer_mutex);
+
+	/* contadores desta politica de outro evento nao servem mais */
+	raw_stall_release_owned(info, input);
+
+	return count;
+}
+
+cpufreq_freq_attr_rw(interleave);
+cpufreq_freq_attr_rw(slack_reclaim);
+cpufreq_freq_attr_rw(acec);
+cpufreq_freq_attr_rw(fast_switch);
+cpufreq_freq_attr_rw(energy_model);
+cpufreq_freq_attr_rw(hybrid);
+cpufreq_freq_attr_rw(sampling_rate);
+cpufreq_freq_attr_rw(up_threshold);
+cpufreq_freq_attr_rw(idle_hints);
+cpufreq_freq_attr_rw(stall_event);
+
+static struct attribute *raw_attributes[] = {
+	&interleave.attr,
+	&acec.attr,
+	&slack_reclaim.attr,
+	&fast_switch.attr,
+	&energy_model.attr,
+	&hybrid.attr,
+	&sampling_rate.attr,
+	&up_threshold.attr,
+	&idle_hints.attr,
+	&stall_event.attr,
+	NULL
+};
+
+static struct attribute_group raw_attr_group = {
+	.attrs = raw_attributes,
+	.name = "raw",
+};
+
+/************************** sysfs end ************************/
+
+/*
+ * Mede o custo real de cada troca de frequencia da politica: o intervalo entre
+ * as notificacoes PRECHANGE e POSTCHANGE do CPU dono da politica. As
+ * notificacoes atrasadas de ->fast_switch nao sao cronometradas, mas contam
+ * como trocas para as estatisticas dos jobs.
+ */
+static int raw_transition_notifier(struct notifier_block *nb, unsigned long val, void *data)
+{
+	struct cpufreq_freqs *freqs = data;
+	struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, freqs->cpu);
+	struct cpufreq_policy *policy = info->policy;
+	unsigned long flags;
+	u64 agora;
+
+	if (!policy || policy->cpu != freqs->cpu)
+		return 0;
+
+	agora = sched_clock();
+	spin_lock_irqsave(&info->lat_lock, flags);
+	if (val == CPUFREQ_POSTCHANGE)
+		info->transitions++;
+	if (!(freqs->flags & CPUFREQ_NOTIFY_DEFERRED)) {
+		if (val == CPUFREQ_PRECHANGE)
+			info->switch_start_ns = agora;
+		else if (val == CPUFREQ_POSTCHANGE && info->switch_start_ns) {
+			if (agora > info->switch_start_ns)
+				raw_lat_hist_add(&info->switch_lat, agora - info->switch_start_ns);
+			info->switch_start_ns = 0;
+		}
+	}
+	spin_unlock_irqrestore(&info->lat_lock, flags);
+	return 0;
+}
+
+static struct notifier_block raw_transition_nb = {
+	.notifier_call = raw_transition_notifier,
+};
+
+static void raw_lat_hist_show(struct seq_file *m, const char *nome, const struct raw_lat_hist *h)
+{
+	int i;
+
+	seq_printf(m, "%s: samples %llu avg %llu ns ewma %llu ns max %llu ns\n", nome,
+		   h->count, h->count ? div64_u64(h->sum_ns, h->count) : 0,
+		   h->ewma_ns, h->max_ns);
+	for (i = 0; i < RAW_LAT_BUCKETS; i++)
+		if (h->bucket[i])
+			seq_printf(m, "  [%llu, %llu) ns: %u\n", 1ULL << i, 1ULL << (i + 1), h->bucket[i]);
+}
+
+static int raw_latency_show(struct seq_file *m, void *v)
+{
+	struct raw_gov_info_struct *info = m->private;
+	struct raw_lat_hist troca, monitor;
+	unsigned long flags;
+
+	spin_lock_irqsave(&info->lat_lock, flags);
+	troca = info->switch_lat;
+	monitor = info->monitor_lat;
+	spin_unlock_irqrestore(&info->lat_lock, flags);
+
+	raw_lat_hist_show(m, "switch", &troca);
+	raw_lat_hist_show(m, "monitor", &monitor);
+	return 0;
+}
+
+static void raw_job_stats_show(struct seq_file *m, unsigned int cpu, const struct raw_job_stats *st)
+{
+	seq_printf(m, "%3u %10llu %8llu %12lld %12lld %12lld %10llu %6u\n", cpu,
+		   st->jobs, st->misses, st->slack_min,
+		   st->jobs ? div64_s64(st->slack_sum, st->jobs) : 0LL,
+		   st->slack_max, st->freq_changes, st->freq_changes_max);
+}
+
+/* /sys/kernel/debug/cpufreq_raw/summary: uma linha por politica sob o RAW GOVERNOR */
+static int raw_summary_show(struct seq_file *m, void *v)
+{
+	struct raw_job_stats st;
+	unsigned long flags;
+	unsigned int cpu;
+
+	seq_printf(m, "cpu       jobs   misses    slack_min    slack_avg    slack_max    changes    max\n");
+
+	mutex_lock(&raw_mutex);
+	for_each_possible_cpu(cpu) {
+		struct raw_gov_info_struct *info = &per_cpu(raw_gov_info, cpu);
+
+		if (!info->stats_active)
+			continue;
+		spin_lock_irqsave(&info->lat_lock, flags);
+		st = info->job_stats;
+		spin_unlock_irqrestore(&info->lat_lock, flags);
+		raw_job_stats_show(m, cpu, &st);
+	}
+	mutex_unlock(&raw_mutex);
+	return 0;
+}
+
+static int raw_summary_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, raw_summary_show, NULL);
+}
+
+static const struct file_operations raw_summary_fops = {
+	.owner		= THIS_MODULE,
+	.open		= raw_summary_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int raw_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, raw_latency_show, inode->i_private);
+}
+
+static const struct file_operations raw_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= raw_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int cpufreq_governor_raw(struct cpufreq_policy *policy, unsigned int event)
 {
 	unsigned int cpu = policy->cpu;
 	struct raw_gov_info_struct *info, *affected_info;
+	bool ultima;
 	int i;
 	int rc = 0;
 
-	freq_table = cpufreq_frequency_get_table(cpu);
 	info = &per_cpu(raw_gov_info, cpu);
 
 	switch (event) {
@@ -341,10 +3061,17 @@ static int cpufreq_governor_raw(struct cpufreq_policy *policy, unsigned int even
 			if (!cpu_online(cpu))
 				return -EINVAL;
 
-			/* initialize raw_gov_info for all affected cpus */
+			/* antes de publicar a politica: o notifier de transicao passa a olhar este info */
+			spin_lock_init(&info->lat_lock);
+			info->switch_start_ns = 0;
+			memset(&info->switch_lat, 0, sizeof(info->switch_lat));
+			memset(&info->monitor_lat, 0, sizeof(info->monitor_lat));
+			info->transitions = 0;
+			memset(&info->job_stats, 0, sizeof(info->job_stats));
+
+			/* initialize raw_gov_info for all affected cpus; a politica eh publicada por raw_gov_init_work() */
 			for_each_cpu(i, policy->cpus) {
 				affected_info = &per_cpu(raw_gov_info, i);
-				affected_info->policy = policy;
 				affected_info->prev_cpu_idle = get_cpu_idle_time_us(i, &affected_info->prev_cpu_wall);
 			}
 
@@ -352,28 +3079,91 @@ static int cpufreq_governor_raw(struct cpufreq_policy *policy, unsigned int even
 
 			/* setup timer */
 			mutex_init(&info->timer_mutex);
-			raw_gov_init_work(info);
+
+			if (!info->sampling_rate)
+				info->sampling_rate = RAW_HYB_DEF_SAMPLING_RATE;
+			if (!info->up_threshold)
+				info->up_threshold = RAW_HYB_DEF_UP_THRESHOLD;
+
+			/* as dicas do cpuidle existem antes que o worker ou o sysfs possam publica-las */
+			info->release_count = 0;
+			for_each_cpu(i, policy->cpus)
+				cpuidle_rt_hint_add(&per_cpu(raw_gov_info, i).idle_hint, i);
+
+			mutex_lock(&raw_mutex);
+			rc = raw_freq_index_build(&info->freq_index, policy);
+			mutex_unlock(&raw_mutex);
+			if (!rc)
+				rc = raw_gov_init_work(info, policy);
+			if (!rc) {
+				rc = sysfs_create_group(&policy->kobj, &raw_attr_group);
+				if (rc)
+					raw_gov_cancel_work(info, policy);
+			}
+			if (rc) {
+				for_each_cpu(i, policy->cpus)
+					cpuidle_rt_hint_remove(&per_cpu(raw_gov_info, i).idle_hint);
+				mutex_lock(&raw_mutex);
+				raw_freq_index_free(&info->freq_index);
+				mutex_unlock(&raw_mutex);
+				mutex_destroy(&info->timer_mutex);
+				return rc;
+			}
+
+			mutex_lock(&raw_mutex);
+			if (!raw_gov_active++) {
+				preempt_notifier_init(&raw_preempt_notifier, &raw_preempt_ops);
+				preempt_notifier_register_global(&raw_preempt_notifier);
+			}
+			info->stats_active = true;
+			mutex_unlock(&raw_mutex);
+
+			if (raw_debugfs_root) {
+				char nome[16];
+
+				snprintf(nome, sizeof(nome), "cpu%u", cpu);
+				info->debugfs_file = debugfs_create_file(nome, 0444, raw_debugfs_root, info, &raw_latency_fops);
+			}
 		break;
 
 		case CPUFREQ_GOV_STOP:
-			/* cancel timer */
-			raw_gov_cancel_work(info);
+			debugfs_remove(info->debugfs_file);
+			info->debugfs_file = NULL;
+
+			mutex_lock(&raw_mutex);
+			info->stats_active = false;
+			ultima = !--raw_gov_active;
+			if (ultima)
+				preempt_notifier_unregister_global(&raw_preempt_notifier);
+			mutex_unlock(&raw_mutex);
+
+			sysfs_remove_group(&policy->kobj, &raw_attr_group);
+
+			/* cancel timer; retira a politica de todas as CPUs afetadas */
+			raw_gov_cancel_work(info, policy);
+
+			/* os contadores perf das tarefas so servem a politicas sob o RAW GOVERNOR */
+			raw_stall_release_owned(info, 0);
 			mutex_destroy(&info->timer_mutex);
 
-			/* clean raw_gov_info for all affected cpus */
-			for_each_cpu (i, policy->cpus) {
-				info = &per_cpu(raw_gov_info, i);
-				info->policy = NULL;
-			}
+			for_each_cpu(i, policy->cpus)
+				cpuidle_rt_hint_remove(&per_cpu(raw_gov_info, i).idle_hint);
+
+			mutex_lock(&raw_mutex);
+			raw_freq_index_free(&info->freq_index);
+			mutex_unlock(&raw_mutex);
 		break;
 
 		case CPUFREQ_GOV_LIMITS:
+			mutex_lock(&info->timer_mutex);
 			mutex_lock(&raw_mutex);
+			rc = raw_freq_index_build(&info->freq_index, policy);
 			if (policy->max < info->policy->cur)
 				__cpufreq_driver_target(info->policy, policy->max, CPUFREQ_RELATION_H);
 			else if (policy->min > info->policy->cur)
 				__cpufreq_driver_target(info->policy, policy->min, CPUFREQ_RELATION_L);
 			mutex_unlock(&raw_mutex);
+			mutex_unlock(&info->timer_mutex);
 		break;
 	}
 	return rc;
@@ -394,12 +3184,75 @@ struct cpufreq_governor cpufreq_gov_raw = {
 
 static int __init cpufreq_gov_raw_init(void)
 {
-	return cpufreq_register_governor(&cpufreq_gov_raw);
+	int rc;
+
+#ifdef CONFIG_IPIPE
+	raw_gov_virq = ipipe_alloc_virq();
+	if (!raw_gov_virq)
+		return -EBUSY;
+
+	rc = ipipe_virtualize_irq(ipipe_root_domain, raw_gov_virq,
+				  &raw_gov_virq_handler, NULL, NULL,
+				  IPIPE_HANDLE_MASK);
+	if (rc)
+		goto free_virq;
+#endif
+
+	rc = misc_register(&raw_ctl_dev);
+	if (rc)
+		goto unvirtualize;
+
+	rc = cpufreq_register_notifier(&raw_transition_nb, CPUFREQ_TRANSITION_NOTIFIER);
+	if (rc)
+		goto deregister;
+
+	/* sem debugfs o governor funciona normalmente, apenas sem os histogramas */
+	raw_debugfs_root = debugfs_create_dir("cpufreq_raw", NULL);
+	if (IS_ERR(raw_debugfs_root))
+		raw_debugfs_root = NULL;
+	if (raw_debugfs_root)
+		debugfs_create_file("summary", 0444, raw_debugfs_root, NULL, &raw_summary_fops);
+
+	raw_stall_init();
+
+	rc = cpufreq_register_governor(&cpufreq_gov_raw);
+	if (rc)
+		goto unregister_notifier;
+	return 0;
+
+unregister_notifier:
+	raw_stall_exit();
+	debugfs_remove_recursive(raw_debugfs_root);
+	cpufreq_unregister_notifier(&raw_transition_nb, CPUFREQ_TRANSITION_NOTIFIER);
+deregister:
+	misc_deregister(&raw_ctl_dev);
+unvirtualize:
+#ifdef CONFIG_IPIPE
+	ipipe_virtualize_irq(ipipe_root_domain, raw_gov_virq,
+			     NULL, NULL, NULL, IPIPE_PASS_MASK);
+free_virq:
+	ipipe_free_virq(raw_gov_virq);
+#endif
+	return rc;
 }
 
 static void __exit cpufreq_gov_raw_exit(void)
 {
 	cpufreq_unregister_governor(&cpufreq_gov_raw);
+
+	/* nenhuma politica resta: os sinais recusados ou atrasados nao seguram mais tarefas */
+	mutex_lock(&raw_mutex);
+	raw_gov_drain_orphans();
+	mutex_unlock(&raw_mutex);
+	raw_stall_exit();
+	debugfs_remove_recursive(raw_debugfs_root);
+	cpufreq_unregister_notifier(&raw_transition_nb, CPUFREQ_TRANSITION_NOTIFIER);
+	misc_deregister(&raw_ctl_dev);
+#ifdef CONFIG_IPIPE
+	ipipe_virtualize_irq(ipipe_root_domain, raw_gov_virq,
+			     NULL, NULL, NULL, IPIPE_PASS_MASK);
+	ipipe_free_virq(raw_gov_virq);
+#endif
 }
 
 MODULE_AUTHOR("Rawlinson <rawlinson.goncalves@gmail.com>");
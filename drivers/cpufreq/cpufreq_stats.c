@@ -20,29 +20,83 @@
 #include <linux/kobject.h>
 #include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/hash.h>
+#include <linux/sched.h>
+#include <linux/preempt.h>
+#include <asm/atomic.h>
 #include <asm/cputime.h>
 
-static spinlock_t cpufreq_stats_lock;
-
 #define CPUFREQ_STATDEVICE_ATTR(_name, _mode, _show) \
 static struct freq_attr _attr_##_name = {\
 	.attr = {.name = __stringify(_name), .mode = _mode, }, \
 	.show = _show,\
 };
 
+/*
+ * The state the CPU is in and since when are packed into one word, so that a
+ * transition can close the previous interval with a single cmpxchg: the
+ * upper bits hold the state index, the lower ones the jiffies of the entry.
+ */
+#define STATS_LAST_TIME_BITS	48
+#define STATS_LAST_TIME_MASK	((1ULL << STATS_LAST_TIME_BITS) - 1)
+#define STATS_INDEX_NONE	0xffff
+
+static inline u64 stats_last_pack(unsigned int index, u64 time)
+{
+	return ((u64)index << STATS_LAST_TIME_BITS) | (time & STATS_LAST_TIME_MASK);
+}
+
+static inline unsigned int stats_last_index(u64 last)
+{
+	return last >> STATS_LAST_TIME_BITS;
+}
+
+static inline u64 stats_last_time(u64 last)
+{
+	return last & STATS_LAST_TIME_MASK;
+}
+
+struct cpufreq_stats_slot {
+	unsigned int freq;	/* 0: empty */
+	unsigned int index;
+};
+
+/*
+ * Counters are kept per CPU, indexed by the CPU that processes the
+ * transition, and only summed when sysfs is read. Each per-CPU block holds
+ * time_in_state[max_state], total_trans and, with details, the
+ * max_state * max_state trans_table.
+ */
 struct cpufreq_stats {
 	unsigned int cpu;
-	unsigned int total_trans;
-	unsigned long long  last_time;
+	atomic64_t last;
 	unsigned int max_state;
 	unsigned int state_num;
-	unsigned int last_index;
-	cputime64_t *time_in_state;
 	unsigned int *freq_table;
+	struct cpufreq_stats_slot *hash;	/* freq -> index, open addressing */
+	unsigned int hash_bits;
+	void __percpu *counters;
+};
+
+static inline cputime64_t *stats_time_in_state(struct cpufreq_stats *stat,
+					       void *counters)
+{
+	return counters;
+}
+
+static inline u64 *stats_total_trans(struct cpufreq_stats *stat,
+				     void *counters)
+{
+	return (u64 *)counters + stat->max_state;
+}
+
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
-	unsigned int *trans_table;
+static inline unsigned int *stats_trans_table(struct cpufreq_stats *stat,
+					      void *counters)
+{
+	return (unsigned int *)((u64 *)counters + stat->max_state + 1);
+}
 #endif
-};
 
 static DEFINE_PER_CPU(struct cpufreq_stats *, cpufreq_stats_table);
 
@@ -51,44 +105,44 @@ struct cpufreq_stats_attribute {
 	ssize_t(*show) (struct cpufreq_stats *, char *);
 };
 
-static int cpufreq_stats_update(unsigned int cpu)
-{
-	struct cpufreq_stats *stat;
-	unsigned long long cur_time;
-
-	cur_time = get_jiffies_64();
-	spin_lock(&cpufreq_stats_lock);
-	stat = per_cpu(cpufreq_stats_table, cpu);
-	if (stat->time_in_state)
-		stat->time_in_state[stat->last_index] =
-			cputime64_add(stat->time_in_state[stat->last_index],
-				      cputime_sub(cur_time, stat->last_time));
-	stat->last_time = cur_time;
-	spin_unlock(&cpufreq_stats_lock);
-	return 0;
-}
-
 static ssize_t show_total_trans(struct cpufreq_policy *policy, char *buf)
 {
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	u64 total = 0;
+	int cpu;
+
 	if (!stat)
 		return 0;
-	return sprintf(buf, "%d\n",
-			per_cpu(cpufreq_stats_table, stat->cpu)->total_trans);
+	for_each_possible_cpu(cpu)
+		total += *stats_total_trans(stat, per_cpu_ptr(stat->counters, cpu));
+	return sprintf(buf, "%llu\n", (unsigned long long)total);
 }
 
 static ssize_t show_time_in_state(struct cpufreq_policy *policy, char *buf)
 {
 	ssize_t len = 0;
-	int i;
+	int i, cpu;
+	u64 last, now;
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
 	if (!stat)
 		return 0;
-	cpufreq_stats_update(stat->cpu);
+
+	/* the open interval is folded in here, not written back */
+	last = atomic64_read(&stat->last);
+	now = get_jiffies_64() & STATS_LAST_TIME_MASK;
+
 	for (i = 0; i < stat->state_num; i++) {
+		cputime64_t time = cputime64_zero;
+
+		for_each_possible_cpu(cpu)
+			time = cputime64_add(time, stats_time_in_state(stat,
+					per_cpu_ptr(stat->counters, cpu))[i]);
+		if (i == stats_last_index(last))
+			time = cputime64_add(time, (now - stats_last_time(last)) &
+					     STATS_LAST_TIME_MASK);
 		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i],
 			(unsigned long long)
-			cputime64_to_clock_t(stat->time_in_state[i]));
+			cputime64_to_clock_t(time));
 	}
 	return len;
 }
@@ -102,7 +156,6 @@ static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
 	if (!stat)
 		return 0;
-	cpufreq_stats_update(stat->cpu);
 	len += snprintf(buf + len, PAGE_SIZE - len, "   From  :    To\n");
 	len += snprintf(buf + len, PAGE_SIZE - len, "         : ");
 	for (i = 0; i < stat->state_num; i++) {
@@ -124,10 +177,17 @@ static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 				stat->freq_table[i]);
 
 		for (j = 0; j < stat->state_num; j++)   {
+			unsigned int count = 0;
+			int cpu;
+
 			if (len >= PAGE_SIZE)
 				break;
+			for_each_possible_cpu(cpu)
+				count += stats_trans_table(stat,
+					per_cpu_ptr(stat->counters, cpu))
+						[i*stat->max_state+j];
 			len += snprintf(buf + len, PAGE_SIZE - len, "%9u ",
-					stat->trans_table[i*stat->max_state+j]);
+					count);
 		}
 		if (len >= PAGE_SIZE)
 			break;
@@ -156,15 +216,186 @@ static struct attribute_group stats_attr_group = {
 	.name = "stats"
 };
 
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+/*
+ * Per-task residency: each CPU remembers the frequency it runs at, the one
+ * before and when it changed; a task going out is credited with the time
+ * since it came in, split at the last transition. If the frequency changed
+ * more than once during one slice, the part before the last change is all
+ * credited to the frequency in effect just before it.
+ */
+struct cpufreq_task_clock {
+	spinlock_t lock;	/* serializes writers */
+	unsigned int seq;	/* odd while a writer is updating */
+	unsigned int freq;
+	unsigned int old_freq;
+	u64 since_ns;		/* cpu_clock() of the last transition */
+	u64 switch_ns;		/* local_clock() of the last switch */
+};
+
+static DEFINE_PER_CPU(struct cpufreq_task_clock, cpufreq_task_clock);
+
+/*
+ * ->sched_out() may run in the I-pipe head domain on top of a root-domain
+ * writer of the same CPU, so the reader gives up instead of spinning on an
+ * odd sequence (read_seqbegin() would never return).
+ */
+#define TASK_CLOCK_READ_RETRIES	4
+
+static void cpufreq_task_stats_credit(struct cpufreq_task_residency *res,
+				      unsigned int freq, u64 ns)
+{
+	int i;
+
+	for (i = 0; i < CPUFREQ_TASK_STATES; i++) {
+		if (res->freq[i] == freq)
+			break;
+		if (!res->freq[i]) {
+			res->freq[i] = freq;
+			break;
+		}
+	}
+	/* more distinct frequencies than slots: the excess is not accounted */
+	if (i < CPUFREQ_TASK_STATES)
+		res->time_ns[i] += ns;
+}
+
+/*
+ * Both hooks stamp the switch, so the slice of the incoming task starts
+ * when the outgoing one was credited even if its ->sched_in() is missed,
+ * e.g. on the first switch after registration.
+ */
+static void cpufreq_task_stats_sched_in(struct preempt_notifier *notifier,
+					int cpu)
+{
+	__this_cpu_write(cpufreq_task_clock.switch_ns, local_clock());
+}
+
+static void cpufreq_task_stats_sched_out(struct preempt_notifier *notifier,
+					 struct task_struct *next)
+{
+	struct cpufreq_task_clock *clk = &__get_cpu_var(cpufreq_task_clock);
+	struct task_struct *prev = current;
+	unsigned int freq, old_freq, seq;
+	u64 now, start, since;
+	int retries = TASK_CLOCK_READ_RETRIES;
+
+	now = local_clock();
+	start = clk->switch_ns;
+	clk->switch_ns = now;
+
+	if (!prev || !prev->pid)
+		return;
+
+	do {
+		if (!retries--)
+			return;
+		seq = ACCESS_ONCE(clk->seq);
+		if (seq & 1)
+			continue;
+		smp_rmb();
+		freq = clk->freq;
+		old_freq = clk->old_freq;
+		since = clk->since_ns;
+		smp_rmb();
+	} while (seq != ACCESS_ONCE(clk->seq) || (seq & 1));
+
+	if (!freq || !start || now <= start)
+		return;
+
+	if (since > start && since < now) {
+		if (old_freq)
+			cpufreq_task_stats_credit(&prev->cpufreq_residency,
+						  old_freq, since - start);
+		start = since;
+	}
+	cpufreq_task_stats_credit(&prev->cpufreq_residency, freq, now - start);
+}
+
+static struct preempt_ops cpufreq_task_stats_ops = {
+	.sched_in	= cpufreq_task_stats_sched_in,
+	.sched_out	= cpufreq_task_stats_sched_out,
+};
+
+static struct preempt_notifier cpufreq_task_stats_notifier;
+
+static void cpufreq_task_stats_set(unsigned int cpu, unsigned int freq)
+{
+	struct cpufreq_task_clock *clk = &per_cpu(cpufreq_task_clock, cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&clk->lock, flags);
+	if (clk->freq != freq) {
+		clk->seq++;
+		smp_wmb();
+		clk->old_freq = clk->freq;
+		clk->freq = freq;
+		clk->since_ns = cpu_clock(cpu);
+		smp_wmb();
+		clk->seq++;
+	}
+	spin_unlock_irqrestore(&clk->lock, flags);
+}
+
+static void cpufreq_task_stats_transition(struct cpufreq_freqs *freq)
+{
+	cpufreq_task_stats_set(freq->cpu, freq->new);
+}
+
+static void cpufreq_task_stats_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(cpufreq_task_clock, cpu).lock);
+	preempt_notifier_init(&cpufreq_task_stats_notifier,
+			      &cpufreq_task_stats_ops);
+	preempt_notifier_register_global(&cpufreq_task_stats_notifier);
+}
+
+/*
+ * The hooks may be running in the head domain with hw IRQs off; the
+ * unregistration waits for those walkers too, so the module text can go
+ * once it returns.
+ */
+static void cpufreq_task_stats_exit(void)
+{
+	preempt_notifier_unregister_global(&cpufreq_task_stats_notifier);
+}
+#else
+static inline void cpufreq_task_stats_set(unsigned int cpu, unsigned int freq) {}
+static inline void cpufreq_task_stats_transition(struct cpufreq_freqs *freq) {}
+static inline void cpufreq_task_stats_init(void) {}
+static inline void cpufreq_task_stats_exit(void) {}
+#endif
+
 static int freq_table_get_index(struct cpufreq_stats *stat, unsigned int freq)
 {
-	int index;
-	for (index = 0; index < stat->max_state; index++)
-		if (stat->freq_table[index] == freq)
-			return index;
+	unsigned int mask = (1U << stat->hash_bits) - 1;
+	unsigned int h = hash_32(freq, stat->hash_bits);
+
+	/* the table is at most half full, so this ends at an empty slot */
+	for (; stat->hash[h].freq; h = (h + 1) & mask)
+		if (stat->hash[h].freq == freq)
+			return stat->hash[h].index;
 	return -1;
 }
 
+/* returns false if @freq was already in the table */
+static bool freq_table_add_index(struct cpufreq_stats *stat, unsigned int freq,
+				 unsigned int index)
+{
+	unsigned int mask = (1U << stat->hash_bits) - 1;
+	unsigned int h = hash_32(freq, stat->hash_bits);
+
+	for (; stat->hash[h].freq; h = (h + 1) & mask)
+		if (stat->hash[h].freq == freq)
+			return false;
+	stat->hash[h].freq = freq;
+	stat->hash[h].index = index;
+	return true;
+}
+
 /* should be called late in the CPU removal sequence so that the stats
  * memory is still available in case someone tries to use it.
  */
@@ -172,7 +403,8 @@ static void cpufreq_stats_free_table(unsigned int cpu)
 {
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, cpu);
 	if (stat) {
-		kfree(stat->time_in_state);
+		free_percpu(stat->counters);
+		kfree(stat->freq_table);
 		kfree(stat);
 	}
 	per_cpu(cpufreq_stats_table, cpu) = NULL;
@@ -194,6 +426,7 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 		struct cpufreq_frequency_table *table)
 {
 	unsigned int i, j, count = 0, ret = 0;
+	int index;
 	struct cpufreq_stats *stat;
 	struct cpufreq_policy *data;
 	unsigned int alloc_size;
@@ -224,40 +457,51 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 		count++;
 	}
 
-	alloc_size = count * sizeof(int) + count * sizeof(cputime64_t);
+	stat->max_state = count;
+	stat->hash_bits = ilog2(roundup_pow_of_two(2 * count + 1));
+
+	alloc_size = count * sizeof(int) +
+		(1 << stat->hash_bits) * sizeof(struct cpufreq_stats_slot);
+	stat->freq_table = kzalloc(alloc_size, GFP_KERNEL);
+	if (!stat->freq_table) {
+		ret = -ENOMEM;
+		goto error_out;
+	}
+	stat->hash = (struct cpufreq_stats_slot *)(stat->freq_table + count);
 
+	alloc_size = count * sizeof(cputime64_t) + sizeof(u64);
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	alloc_size += count * count * sizeof(int);
 #endif
-	stat->max_state = count;
-	stat->time_in_state = kzalloc(alloc_size, GFP_KERNEL);
-	if (!stat->time_in_state) {
+	stat->counters = __alloc_percpu(alloc_size, __alignof__(u64));
+	if (!stat->counters) {
 		ret = -ENOMEM;
 		goto error_out;
 	}
-	stat->freq_table = (unsigned int *)(stat->time_in_state + count);
 
-#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
-	stat->trans_table = stat->freq_table + count;
-#endif
 	j = 0;
 	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
 		unsigned int freq = table[i].frequency;
 		if (freq == CPUFREQ_ENTRY_INVALID)
 			continue;
-		if (freq_table_get_index(stat, freq) == -1)
+		if (freq_table_add_index(stat, freq, j))
 			stat->freq_table[j++] = freq;
 	}
 	stat->state_num = j;
-	spin_lock(&cpufreq_stats_lock);
-	stat->last_time = get_jiffies_64();
-	stat->last_index = freq_table_get_index(stat, policy->cur);
-	spin_unlock(&cpufreq_stats_lock);
+
+	for_each_cpu(i, policy->cpus)
+		cpufreq_task_stats_set(i, policy->cur);
+
+	index = freq_table_get_index(stat, policy->cur);
+	atomic64_set(&stat->last, stats_last_pack(index == -1 ?
+						  STATS_INDEX_NONE : index,
+						  get_jiffies_64()));
 	cpufreq_cpu_put(data);
 	return 0;
 error_out:
 	cpufreq_cpu_put(data);
 error_get_fail:
+	kfree(stat->freq_table);
 	kfree(stat);
 	per_cpu(cpufreq_stats_table, cpu) = NULL;
 	return ret;
@@ -286,32 +530,50 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 {
 	struct cpufreq_freqs *freq = data;
 	struct cpufreq_stats *stat;
-	int old_index, new_index;
+	unsigned int old_index;
+	int new_index;
+	u64 old, now;
+	void *counters;
 
 	if (val != CPUFREQ_POSTCHANGE)
 		return 0;
 
+	cpufreq_task_stats_transition(freq);
+
 	stat = per_cpu(cpufreq_stats_table, freq->cpu);
 	if (!stat)
 		return 0;
 
-	old_index = stat->last_index;
 	new_index = freq_table_get_index(stat, freq->new);
-
-	cpufreq_stats_update(freq->cpu);
-	if (old_index == new_index)
+	if (new_index == -1)
 		return 0;
 
-	if (old_index == -1 || new_index == -1)
+	/*
+	 * Transitions of the same CPU may race (e.g. ->target() against the
+	 * deferred ->fast_switch() notifications): whoever swaps 'last' owns
+	 * the interval that ends now, so each jiffy is accounted once.
+	 */
+	now = get_jiffies_64();
+	do {
+		old = atomic64_read(&stat->last);
+		old_index = stats_last_index(old);
+		if (old_index == new_index)
+			return 0;
+	} while (atomic64_cmpxchg(&stat->last, old,
+				  stats_last_pack(new_index, now)) != old);
+
+	if (old_index == STATS_INDEX_NONE)
 		return 0;
 
-	spin_lock(&cpufreq_stats_lock);
-	stat->last_index = new_index;
+	counters = get_cpu_ptr(stat->counters);
+	stats_time_in_state(stat, counters)[old_index] =
+		cputime64_add(stats_time_in_state(stat, counters)[old_index],
+			      (now - stats_last_time(old)) & STATS_LAST_TIME_MASK);
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
-	stat->trans_table[old_index * stat->max_state + new_index]++;
+	stats_trans_table(stat, counters)[old_index * stat->max_state + new_index]++;
 #endif
-	stat->total_trans++;
-	spin_unlock(&cpufreq_stats_lock);
+	(*stats_total_trans(stat, counters))++;
+	put_cpu_ptr(stat->counters);
 	return 0;
 }
 
@@ -357,7 +619,6 @@ static int __init cpufreq_stats_init(void)
 	int ret;
 	unsigned int cpu;
 
-	spin_lock_init(&cpufreq_stats_lock);
 	ret = cpufreq_register_notifier(&notifier_policy_block,
 				CPUFREQ_POLICY_NOTIFIER);
 	if (ret)
@@ -371,6 +632,7 @@ static int __init cpufreq_stats_init(void)
 		return ret;
 	}
 
+	cpufreq_task_stats_init();
 	register_hotcpu_notifier(&cpufreq_stat_cpu_notifier);
 	for_each_online_cpu(cpu) {
 		cpufreq_update_policy(cpu);
@@ -386,6 +648,7 @@ static void __exit cpufreq_stats_exit(void)
 	cpufreq_unregister_notifier(&notifier_trans_block,
 			CPUFREQ_TRANSITION_NOTIFIER);
 	unregister_hotcpu_notifier(&cpufreq_stat_cpu_notifier);
+	cpufreq_task_stats_exit();
 	for_each_online_cpu(cpu) {
 		cpufreq_stats_free_table(cpu);
 	}
@@ -0,0 +1,564 @@
+/*
+ * linux/drivers/cpufreq/rawtorture.c
+ *
+ * Deadline/energy benchmark for cpufreq governors, in the spirit of
+ * kernel/rcutorture.c. Runs a synthetic set of periodic SCHED_FIFO tasks
+ * on top of the dummy-cpufreq driver and reports, for each governor that
+ * was active while the test ran, deadline misses, monitor activation
+ * latency and the energy modeled from the driver's residency counters.
+ *
+ * Each task has a period (which is also its relative deadline), a WCEC
+ * and an actual-cycle distribution: every job retires a uniformly
+ * distributed number of cycles between bcec_pct% and 100% of the WCEC,
+ * split in nsegments chunks. Under a governor that provides the raw
+ * interface the task publishes tsk_wcec/rwcec, asks ->set_frequency() at
+ * release and signals the monitor through ->wake_up_kworker() between
+ * chunks, as an RTAI task returning from preemption would.
+ *
+ * The governor can be switched through sysfs while the test runs; the
+ * statistics are kept per governor. Unload the module to stop the test
+ * and print the final report.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/cpufreq_dummy.h>
+#include <linux/math64.h>
+
+MODULE_LICENSE("GPL");
+
+static int ntasks = 3;		/* # periodic tasks */
+static int cpu;			/* CPU the task set runs on */
+static int utilization = 70;	/* WCEC utilization at max freq, percent */
+static int period_min = 10;	/* Shortest period, in ms */
+static int period_max = 100;	/* Longest period, in ms */
+static int bcec_pct = 50;	/* Best-case cycles, percent of WCEC */
+static int nsegments = 4;	/* Chunks (monitor signals) per job */
+static int ceff = 1000;		/* Effective capacitance, in pF */
+static int idle_pct = 10;	/* Idle power, percent of active power */
+static int stat_interval;	/* Interval between stats, in seconds. */
+				/*  Defaults to "only at end of test". */
+static int verbose;		/* Print more debug info. */
+
+module_param(ntasks, int, 0444);
+MODULE_PARM_DESC(ntasks, "Number of periodic tasks");
+module_param(cpu, int, 0444);
+MODULE_PARM_DESC(cpu, "CPU the task set runs on");
+module_param(utilization, int, 0444);
+MODULE_PARM_DESC(utilization, "Task set WCEC utilization at max frequency (%)");
+module_param(period_min, int, 0444);
+MODULE_PARM_DESC(period_min, "Shortest task period (ms)");
+module_param(period_max, int, 0444);
+MODULE_PARM_DESC(period_max, "Longest task period (ms)");
+module_param(bcec_pct, int, 0444);
+MODULE_PARM_DESC(bcec_pct, "Best-case execution cycles, percent of WCEC");
+module_param(nsegments, int, 0444);
+MODULE_PARM_DESC(nsegments, "Chunks per job; the monitor is signalled between chunks");
+module_param(ceff, int, 0444);
+MODULE_PARM_DESC(ceff, "Effective capacitance for the energy model (pF)");
+module_param(idle_pct, int, 0444);
+MODULE_PARM_DESC(idle_pct, "Idle power, percent of active power at the same state");
+module_param(stat_interval, int, 0444);
+MODULE_PARM_DESC(stat_interval, "Number of seconds between stats printk()s");
+module_param(verbose, bool, 0444);
+MODULE_PARM_DESC(verbose, "Enable verbose debugging printk()s");
+
+#define TORTURE_FLAG "rawtorture: "
+#define PRINTK_STRING(s) \
+	do { printk(KERN_ALERT TORTURE_FLAG s "\n"); } while (0)
+#define VERBOSE_PRINTK_STRING(s) \
+	do { if (verbose) printk(KERN_ALERT TORTURE_FLAG s "\n"); } while (0)
+
+#define RAW_TORTURE_MAX_GOV	8
+
+struct raw_random_state {
+	unsigned long rrs_state;
+	long rrs_count;
+};
+
+#define RAW_RANDOM_MULT 39916801  /* prime */
+#define RAW_RANDOM_ADD	479001701 /* prime */
+#define RAW_RANDOM_REFRESH 10000
+
+#define DEFINE_RAW_RANDOM(name) struct raw_random_state name = { 0, 0 }
+
+struct raw_torture_task {
+	struct task_struct *task;
+	u64 period_ns;
+	u64 wcec;
+	int prio;
+};
+
+/* Everything measured while a given governor was in charge of the CPU. */
+struct raw_torture_gov_stats {
+	char name[CPUFREQ_NAME_LEN];
+	unsigned long jobs;
+	unsigned long misses;
+	unsigned long overruns;		/* releases skipped after a miss */
+	u64 max_lateness_ns;
+	unsigned long nlatency;
+	u64 sum_latency_ns;
+	u64 max_latency_ns;
+	u64 busy_ns;
+	u64 time_ns;
+	u64 energy_uj;
+};
+
+static struct raw_torture_task *raw_torture_tasks;
+static struct task_struct *stats_task;
+static struct cpufreq_policy *raw_torture_policy;
+
+static DEFINE_SPINLOCK(raw_torture_lock);
+static struct raw_torture_gov_stats raw_torture_gov[RAW_TORTURE_MAX_GOV];
+static int raw_torture_ngov;
+static int raw_torture_cur_gov = -1;
+static struct cpufreq_dummy_state raw_torture_last[CPUFREQ_DUMMY_MAX_STATES];
+static u64 raw_torture_signal_ns;	/* last release/signal, 0 when answered */
+static unsigned long n_raw_torture_gov_overflow;
+
+/*
+ * Crude but fast random-number generator.  Uses a linear congruential
+ * generator, with occasional help from local_clock().
+ */
+static unsigned long
+raw_random(struct raw_random_state *rrsp)
+{
+	if (--rrsp->rrs_count < 0) {
+		rrsp->rrs_state += (unsigned long)local_clock();
+		rrsp->rrs_count = RAW_RANDOM_REFRESH;
+	}
+	rrsp->rrs_state = rrsp->rrs_state * RAW_RANDOM_MULT + RAW_RANDOM_ADD;
+	return swahw32(rrsp->rrs_state);
+}
+
+/*
+ * Modeled power of one operating point, in mW: P = Ceff * f * V^2.
+ */
+static u64 raw_torture_power_mw(const struct cpufreq_dummy_state *st)
+{
+	u64 p = (u64)ceff * st->freq;
+
+	p *= (u64)st->voltage * st->voltage;
+	return div64_u64(p, 1000000000000ULL);
+}
+
+/* Find (or create) the statistics slot of @name. Caller holds the lock. */
+static int raw_torture_gov_slot(const char *name)
+{
+	int i;
+
+	for (i = 0; i < raw_torture_ngov; i++)
+		if (!strncmp(raw_torture_gov[i].name, name, CPUFREQ_NAME_LEN))
+			return i;
+	if (raw_torture_ngov == RAW_TORTURE_MAX_GOV) {
+		n_raw_torture_gov_overflow++;
+		return -1;
+	}
+	strlcpy(raw_torture_gov[i].name, name, CPUFREQ_NAME_LEN);
+	return raw_torture_ngov++;
+}
+
+/*
+ * Charge the energy and residency accumulated by the driver since the last
+ * call to the governor that was active, then look up the current governor.
+ * Caller holds raw_torture_lock.
+ */
+static void raw_torture_account(void)
+{
+	struct cpufreq_dummy_state now[CPUFREQ_DUMMY_MAX_STATES];
+	struct cpufreq_governor *gov;
+	int i, n;
+
+	n = cpufreq_dummy_snapshot(cpu, now, CPUFREQ_DUMMY_MAX_STATES);
+	if (n <= 0)
+		return;
+
+	if (raw_torture_cur_gov >= 0) {
+		struct raw_torture_gov_stats *gs = &raw_torture_gov[raw_torture_cur_gov];
+
+		for (i = 0; i < n; i++) {
+			u64 busy = now[i].busy_ns - raw_torture_last[i].busy_ns;
+			u64 resid = now[i].resid_ns - raw_torture_last[i].resid_ns;
+			u64 idle = resid > busy ? resid - busy : 0;
+			u64 p = raw_torture_power_mw(&now[i]);
+
+			gs->busy_ns += busy;
+			gs->time_ns += max(resid, busy);
+			gs->energy_uj += div64_u64(p * busy, 1000000ULL) +
+					 div64_u64(p * idle * idle_pct, 100000000ULL);
+		}
+	}
+	memcpy(raw_torture_last, now, n * sizeof(now[0]));
+
+	gov = ACCESS_ONCE(raw_torture_policy->governor);
+	raw_torture_cur_gov = gov ? raw_torture_gov_slot(gov->name) : -1;
+}
+
+/*
+ * Measure how long the governor takes to act on a release or a monitor
+ * signal: the first transition after the signal closes the interval.
+ */
+static int raw_torture_notifier(struct notifier_block *nb, unsigned long val,
+				void *data)
+{
+	struct cpufreq_freqs *freqs = data;
+	unsigned long flags;
+	u64 now, lat;
+
+	if (val != CPUFREQ_POSTCHANGE || freqs->cpu != cpu)
+		return 0;
+
+	now = local_clock();
+	spin_lock_irqsave(&raw_torture_lock, flags);
+	if (raw_torture_signal_ns && raw_torture_cur_gov >= 0) {
+		struct raw_torture_gov_stats *gs = &raw_torture_gov[raw_torture_cur_gov];
+
+		lat = now - raw_torture_signal_ns;
+		gs->nlatency++;
+		gs->sum_latency_ns += lat;
+		if (lat > gs->max_latency_ns)
+			gs->max_latency_ns = lat;
+		raw_torture_signal_ns = 0;
+	}
+	spin_unlock_irqrestore(&raw_torture_lock, flags);
+	return 0;
+}
+
+static struct notifier_block raw_torture_nb = {
+	.notifier_call = raw_torture_notifier,
+};
+
+static void raw_torture_signal(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&raw_torture_lock, flags);
+	if (!raw_torture_signal_ns)
+		raw_torture_signal_ns = local_clock();
+	spin_unlock_irqrestore(&raw_torture_lock, flags);
+}
+
+static void raw_torture_job_done(u64 end_ns, u64 deadline_ns, unsigned long skipped)
+{
+	struct raw_torture_gov_stats *gs;
+	unsigned long flags;
+
+	spin_lock_irqsave(&raw_torture_lock, flags);
+	raw_torture_account();
+	if (raw_torture_cur_gov >= 0) {
+		gs = &raw_torture_gov[raw_torture_cur_gov];
+		gs->jobs++;
+		gs->overruns += skipped;
+		if (end_ns > deadline_ns) {
+			gs->misses++;
+			if (end_ns - deadline_ns > gs->max_lateness_ns)
+				gs->max_lateness_ns = end_ns - deadline_ns;
+		}
+	}
+	spin_unlock_irqrestore(&raw_torture_lock, flags);
+}
+
+/*
+ * One periodic task. Jobs are released on absolute CLOCK_MONOTONIC
+ * instants; the same time base is handed to the governor, which only
+ * uses the difference between tick and deadline.
+ */
+static int
+raw_torture_periodic(void *arg)
+{
+	struct raw_torture_task *rt = arg;
+	struct sched_param sp = { .sched_priority = rt->prio };
+	struct cpufreq_policy *policy = raw_torture_policy;
+	DEFINE_RAW_RANDOM(rand);
+	ktime_t release;
+
+	VERBOSE_PRINTK_STRING("raw_torture_periodic task started");
+	sched_setscheduler(current, SCHED_FIFO, &sp);
+
+	current->cpu_frequency_min = 0;
+	release = ktime_get();
+
+	while (!kthread_should_stop()) {
+		struct cpufreq_governor *gov;
+		u64 rel_ns, deadline_ns, now_ns, actual, seg;
+		unsigned long skipped = 0;
+		int i;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout(&release, HRTIMER_MODE_ABS);
+		if (kthread_should_stop())
+			break;
+
+		rel_ns = ktime_to_ns(release);
+		deadline_ns = rel_ns + rt->period_ns;
+		actual = rt->wcec * (bcec_pct + raw_random(&rand) % (101 - bcec_pct)) / 100;
+		seg = max_t(u64, div64_u64(actual, nsegments), 1);
+
+		current->tsk_wcec = rt->wcec;
+		current->rwcec = rt->wcec;
+		current->state_task_period = TASK_PERIOD_RUNNING;
+
+		gov = ACCESS_ONCE(policy->governor);
+		raw_torture_signal();
+		if (gov && gov->set_frequency)
+			gov->set_frequency(policy, current,
+					   div64_u64(rt->wcec * 1000000ULL, rt->period_ns));
+
+		for (i = 0; i < nsegments && actual; i++) {
+			u64 chunk = (i == nsegments - 1) ? actual : min(seg, actual);
+
+			cpufreq_dummy_run_cycles(chunk);
+			actual -= chunk;
+			current->rwcec -= min_t(unsigned long, current->rwcec, chunk);
+
+			gov = ACCESS_ONCE(policy->governor);
+			if (actual && gov && gov->wake_up_kworker) {
+				raw_torture_signal();
+				gov->wake_up_kworker(policy, current,
+						     ktime_to_ns(ktime_get()), deadline_ns);
+			}
+		}
+
+		current->rwcec = 0;
+		current->state_task_period = TASK_PERIOD_FINISHED;
+		now_ns = ktime_to_ns(ktime_get());
+
+		/* a late job consumes the releases it overran */
+		release = ktime_add_ns(release, rt->period_ns);
+		while (ktime_to_ns(release) + rt->period_ns <= now_ns) {
+			release = ktime_add_ns(release, rt->period_ns);
+			skipped++;
+		}
+		raw_torture_job_done(now_ns, deadline_ns, skipped);
+	}
+
+	current->state_task_period = TASK_PERIOD_UNDEFINED;
+	VERBOSE_PRINTK_STRING("raw_torture_periodic task stopping");
+	return 0;
+}
+
+static void
+raw_torture_stats_print(void)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&raw_torture_lock, flags);
+	raw_torture_account();
+	for (i = 0; i < raw_torture_ngov; i++) {
+		struct raw_torture_gov_stats *gs = &raw_torture_gov[i];
+
+		printk(KERN_ALERT TORTURE_FLAG
+		       "gov: %s jobs: %lu misses: %lu%s overruns: %lu "
+		       "max_lateness: %llu us latency(avg/max): %llu/%llu us "
+		       "busy: %llu ms time: %llu ms energy: %llu uJ\n",
+		       gs->name, gs->jobs, gs->misses, gs->misses ? " !!!" : "",
+		       gs->overruns,
+		       div64_u64(gs->max_lateness_ns, NSEC_PER_USEC),
+		       gs->nlatency ?
+				div64_u64(gs->sum_latency_ns, gs->nlatency * NSEC_PER_USEC) : 0,
+		       div64_u64(gs->max_latency_ns, NSEC_PER_USEC),
+		       div64_u64(gs->busy_ns, NSEC_PER_MSEC),
+		       div64_u64(gs->time_ns, NSEC_PER_MSEC),
+		       gs->energy_uj);
+	}
+	if (n_raw_torture_gov_overflow)
+		printk(KERN_ALERT TORTURE_FLAG "%lu samples under untracked governors\n",
+		       n_raw_torture_gov_overflow);
+	spin_unlock_irqrestore(&raw_torture_lock, flags);
+}
+
+/*
+ * Periodically prints torture statistics, if periodic statistics printing
+ * was specified via the stat_interval module parameter.
+ */
+static int
+raw_torture_stats(void *arg)
+{
+	VERBOSE_PRINTK_STRING("raw_torture_stats task started");
+	do {
+		schedule_timeout_interruptible(stat_interval * HZ);
+		raw_torture_stats_print();
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("raw_torture_stats task stopping");
+	return 0;
+}
+
+static inline void
+raw_torture_print_module_parms(char *tag)
+{
+	printk(KERN_ALERT TORTURE_FLAG
+	       "--- %s: ntasks=%d cpu=%d utilization=%d period_min=%d "
+	       "period_max=%d bcec_pct=%d nsegments=%d ceff=%d idle_pct=%d "
+	       "stat_interval=%d verbose=%d\n",
+	       tag, ntasks, cpu, utilization, period_min, period_max, bcec_pct,
+	       nsegments, ceff, idle_pct, stat_interval, verbose);
+}
+
+static void
+raw_torture_cleanup(void)
+{
+	unsigned long misses = 0;
+	int i;
+
+	if (raw_torture_tasks) {
+		for (i = 0; i < ntasks; i++) {
+			if (raw_torture_tasks[i].task) {
+				VERBOSE_PRINTK_STRING("Stopping raw_torture_periodic task");
+				kthread_stop(raw_torture_tasks[i].task);
+			}
+			raw_torture_tasks[i].task = NULL;
+		}
+		kfree(raw_torture_tasks);
+		raw_torture_tasks = NULL;
+	}
+
+	if (stats_task) {
+		VERBOSE_PRINTK_STRING("Stopping raw_torture_stats task");
+		kthread_stop(stats_task);
+	}
+	stats_task = NULL;
+
+	cpufreq_unregister_notifier(&raw_torture_nb, CPUFREQ_TRANSITION_NOTIFIER);
+
+	raw_torture_stats_print();
+	cpufreq_cpu_put(raw_torture_policy);
+	raw_torture_policy = NULL;
+
+	for (i = 0; i < raw_torture_ngov; i++)
+		misses += raw_torture_gov[i].misses;
+	if (misses)
+		raw_torture_print_module_parms("End of test: DEADLINE MISSES");
+	else
+		raw_torture_print_module_parms("End of test: SUCCESS");
+}
+
+/*
+ * Build the task set: periods spread geometrically-ish between period_min
+ * and period_max, WCEC sized so that the set's utilization at the policy's
+ * maximum frequency is utilization%, rate-monotonic priorities.
+ */
+static int __init raw_torture_build_taskset(void)
+{
+	unsigned int fmax = raw_torture_policy->cpuinfo.max_freq;
+	int i;
+
+	raw_torture_tasks = kcalloc(ntasks, sizeof(*raw_torture_tasks), GFP_KERNEL);
+	if (!raw_torture_tasks)
+		return -ENOMEM;
+
+	for (i = 0; i < ntasks; i++) {
+		struct raw_torture_task *rt = &raw_torture_tasks[i];
+		u64 period_ms = period_min;
+
+		if (ntasks > 1)
+			period_ms += (u64)(period_max - period_min) * i * i /
+				     ((ntasks - 1) * (ntasks - 1));
+		rt->period_ns = period_ms * NSEC_PER_MSEC;
+		/* cycles = kHz * ns / 10^6, shared evenly among the tasks */
+		rt->wcec = div64_u64((u64)fmax * rt->period_ns * utilization,
+				     100ULL * 1000000ULL * ntasks);
+		rt->prio = MAX_RT_PRIO / 2 - i;
+	}
+	return 0;
+}
+
+static int __init
+raw_torture_init(void)
+{
+	int i;
+	int firsterr = 0;
+
+	if (ntasks <= 0 || ntasks > MAX_RT_PRIO / 2 ||
+	    period_min <= 0 || period_max < period_min ||
+	    utilization <= 0 || utilization > 100 ||
+	    bcec_pct < 0 || bcec_pct > 100 || nsegments <= 0 ||
+	    ceff <= 0 || idle_pct < 0 || idle_pct > 100)
+		return -EINVAL;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return -EINVAL;
+
+	raw_torture_policy = cpufreq_cpu_get(cpu);
+	if (!raw_torture_policy) {
+		PRINTK_STRING("no cpufreq policy on the test CPU");
+		return -ENODEV;
+	}
+	if (cpufreq_dummy_snapshot(cpu, raw_torture_last, CPUFREQ_DUMMY_MAX_STATES) <= 0) {
+		PRINTK_STRING("dummy-cpufreq is not driving the test CPU");
+		cpufreq_cpu_put(raw_torture_policy);
+		raw_torture_policy = NULL;
+		return -ENODEV;
+	}
+
+	raw_torture_print_module_parms("Start of test");
+
+	firsterr = raw_torture_build_taskset();
+	if (firsterr)
+		goto unwind;
+
+	firsterr = cpufreq_register_notifier(&raw_torture_nb,
+					    CPUFREQ_TRANSITION_NOTIFIER);
+	if (firsterr)
+		goto unwind;
+
+	spin_lock_irq(&raw_torture_lock);
+	raw_torture_account();
+	spin_unlock_irq(&raw_torture_lock);
+
+	for (i = 0; i < ntasks; i++) {
+		struct task_struct *t;
+
+		VERBOSE_PRINTK_STRING("Creating raw_torture_periodic task");
+		t = kthread_create(raw_torture_periodic, &raw_torture_tasks[i],
+				   "raw_torture_periodic/%d", i);
+		if (IS_ERR(t)) {
+			firsterr = PTR_ERR(t);
+			PRINTK_STRING("Failed to create periodic task");
+			goto unwind;
+		}
+		kthread_bind(t, cpu);
+		raw_torture_tasks[i].task = t;
+		if (verbose)
+			printk(KERN_ALERT TORTURE_FLAG "task %d: period %llu ms wcec %llu\n",
+			       i, div64_u64(raw_torture_tasks[i].period_ns, NSEC_PER_MSEC),
+			       raw_torture_tasks[i].wcec);
+	}
+	for (i = 0; i < ntasks; i++)
+		wake_up_process(raw_torture_tasks[i].task);
+
+	if (stat_interval > 0) {
+		VERBOSE_PRINTK_STRING("Creating raw_torture_stats task");
+		stats_task = kthread_run(raw_torture_stats, NULL,
+					 "raw_torture_stats");
+		if (IS_ERR(stats_task)) {
+			firsterr = PTR_ERR(stats_task);
+			PRINTK_STRING("Failed to create stats");
+			stats_task = NULL;
+			goto unwind;
+		}
+	}
+	return 0;
+
+unwind:
+	raw_torture_cleanup();
+	return firsterr;
+}
+
+module_init(raw_torture_init);
+module_exit(raw_torture_cleanup);
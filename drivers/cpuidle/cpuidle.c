@@ -17,6 +17,9 @@
 #include <linux/cpuidle.h>
 #include <linux/ktime.h>
 #include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/smp.h>
 #include <trace/events/power.h>
 
 #include "cpuidle.h"
@@ -420,15 +423,186 @@ static inline void latency_notifier_init(struct notifier_block *n)
 
 #endif /* CONFIG_SMP */
 
+/*
+ * Aggregated real-time hints of one CPU. Writers hold the lock; the idle
+ * governors read the aggregate locklessly under the seqcount.
+ */
+struct cpuidle_rt_cpu {
+	spinlock_t		lock;
+	struct list_head	hints;
+	seqcount_t		seq;
+	u64			wakeup_ns;
+	s32			latency_us;
+};
+
+static DEFINE_PER_CPU(struct cpuidle_rt_cpu, cpuidle_rt);
+
+static void cpuidle_rt_kick(void *v)
+{
+	/* we already woke the CPU up, nothing more to do */
+}
+
+/* caller holds rt->lock; returns true if the constraint became stricter */
+static bool cpuidle_rt_aggregate(struct cpuidle_rt_cpu *rt)
+{
+	struct cpuidle_rt_hint *hint;
+	u64 wakeup_ns = 0;
+	s32 latency_us = PM_QOS_DEFAULT_VALUE;
+	bool stricter;
+
+	list_for_each_entry(hint, &rt->hints, node) {
+		if (hint->wakeup_ns && (!wakeup_ns || hint->wakeup_ns < wakeup_ns))
+			wakeup_ns = hint->wakeup_ns;
+		if (hint->latency_us >= 0 &&
+		    (latency_us < 0 || hint->latency_us < latency_us))
+			latency_us = hint->latency_us;
+	}
+
+	stricter = (wakeup_ns && (!rt->wakeup_ns || wakeup_ns < rt->wakeup_ns)) ||
+		   (latency_us >= 0 &&
+		    (rt->latency_us < 0 || latency_us < rt->latency_us));
+
+	write_seqcount_begin(&rt->seq);
+	rt->wakeup_ns = wakeup_ns;
+	rt->latency_us = latency_us;
+	write_seqcount_end(&rt->seq);
+
+	return stricter;
+}
+
+static void cpuidle_rt_changed(int cpu, bool stricter)
+{
+	int this_cpu;
+
+	/*
+	 * A CPU already idle picked its state under the old constraint: wake
+	 * it so that it selects again. Relaxed constraints wait for the next
+	 * natural wake-up.
+	 */
+	if (!stricter)
+		return;
+
+	this_cpu = get_cpu();
+	if (cpu != this_cpu && cpu_online(cpu))
+		smp_call_function_single(cpu, cpuidle_rt_kick, NULL, 0);
+	put_cpu();
+}
+
+/**
+ * cpuidle_rt_hint_add - start publishing real-time hints for a CPU
+ * @hint: the request, with no constraint until cpuidle_rt_hint_update()
+ * @cpu: the CPU it applies to
+ */
+void cpuidle_rt_hint_add(struct cpuidle_rt_hint *hint, int cpu)
+{
+	struct cpuidle_rt_cpu *rt = &per_cpu(cpuidle_rt, cpu);
+	unsigned long flags;
+
+	hint->cpu = cpu;
+	hint->wakeup_ns = 0;
+	hint->latency_us = PM_QOS_DEFAULT_VALUE;
+
+	spin_lock_irqsave(&rt->lock, flags);
+	list_add(&hint->node, &rt->hints);
+	spin_unlock_irqrestore(&rt->lock, flags);
+}
+EXPORT_SYMBOL_GPL(cpuidle_rt_hint_add);
+
+/**
+ * cpuidle_rt_hint_update - publish the next real-time event of a CPU
+ * @hint: a request added with cpuidle_rt_hint_add()
+ * @wakeup_ns: ktime_get() of the next job release, in ns, 0 if unknown
+ * @latency_us: exit latency the job tolerates, PM_QOS_DEFAULT_VALUE if any
+ *
+ * Must be called from process context with interrupts enabled.
+ */
+void cpuidle_rt_hint_update(struct cpuidle_rt_hint *hint, u64 wakeup_ns,
+			    s32 latency_us)
+{
+	struct cpuidle_rt_cpu *rt = &per_cpu(cpuidle_rt, hint->cpu);
+	unsigned long flags;
+	bool stricter;
+
+	if (hint->wakeup_ns == wakeup_ns && hint->latency_us == latency_us)
+		return;
+
+	spin_lock_irqsave(&rt->lock, flags);
+	hint->wakeup_ns = wakeup_ns;
+	hint->latency_us = latency_us;
+	stricter = cpuidle_rt_aggregate(rt);
+	spin_unlock_irqrestore(&rt->lock, flags);
+
+	cpuidle_rt_changed(hint->cpu, stricter);
+}
+EXPORT_SYMBOL_GPL(cpuidle_rt_hint_update);
+
+/**
+ * cpuidle_rt_hint_remove - stop publishing real-time hints
+ * @hint: a request added with cpuidle_rt_hint_add()
+ */
+void cpuidle_rt_hint_remove(struct cpuidle_rt_hint *hint)
+{
+	struct cpuidle_rt_cpu *rt = &per_cpu(cpuidle_rt, hint->cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&rt->lock, flags);
+	list_del(&hint->node);
+	cpuidle_rt_aggregate(rt);
+	spin_unlock_irqrestore(&rt->lock, flags);
+}
+EXPORT_SYMBOL_GPL(cpuidle_rt_hint_remove);
+
+/**
+ * cpuidle_rt_constraint - real-time constraint of a CPU for the idle governors
+ * @cpu: the CPU about to go idle
+ * @sleep_us: set to the time left until the next known job release
+ * @latency_us: set to the exit latency tolerated, or PM_QOS_DEFAULT_VALUE
+ *
+ * Returns 0 if a hint applies, -ENODATA if none does (including a release
+ * that is already in the past).
+ */
+int cpuidle_rt_constraint(int cpu, unsigned int *sleep_us, int *latency_us)
+{
+	struct cpuidle_rt_cpu *rt = &per_cpu(cpuidle_rt, cpu);
+	unsigned int seq;
+	u64 wakeup_ns, now;
+	s32 latency;
+
+	do {
+		seq = read_seqcount_begin(&rt->seq);
+		wakeup_ns = rt->wakeup_ns;
+		latency = rt->latency_us;
+	} while (read_seqcount_retry(&rt->seq, seq));
+
+	/* the hint may come from another CPU: sched_clock() is per-CPU */
+	now = ktime_to_ns(ktime_get());
+	if (!wakeup_ns || wakeup_ns <= now)
+		return -ENODATA;
+
+	*sleep_us = min_t(u64, div_u64(wakeup_ns - now, NSEC_PER_USEC), UINT_MAX);
+	*latency_us = latency;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(cpuidle_rt_constraint);
+
 /**
  * cpuidle_init - core initializer
  */
 static int __init cpuidle_init(void)
 {
-	int ret;
+	int ret, cpu;
 
 	pm_idle_old = pm_idle;
 
+	for_each_possible_cpu(cpu) {
+		struct cpuidle_rt_cpu *rt = &per_cpu(cpuidle_rt, cpu);
+
+		spin_lock_init(&rt->lock);
+		INIT_LIST_HEAD(&rt->hints);
+		seqcount_init(&rt->seq);
+		rt->latency_us = PM_QOS_DEFAULT_VALUE;
+	}
+
 	ret = cpuidle_add_class_sysfs(&cpu_sysdev_class);
 	if (ret)
 		return ret;
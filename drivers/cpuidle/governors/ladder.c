@@ -68,6 +68,13 @@ static int ladder_select_state(struct cpuidle_device *dev)
 	struct ladder_device_state *last_state;
 	int last_residency, last_idx = ldev->last_state_idx;
 	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	unsigned int rt_sleep_us;
+	int rt_latency_us;
+
+	/* the next real-time job must not start later than its budget allows */
+	if (!cpuidle_rt_constraint(dev->cpu, &rt_sleep_us, &rt_latency_us) &&
+	    rt_latency_us >= 0 && rt_latency_us < latency_req)
+		latency_req = rt_latency_us;
 
 	/* Special case when user has set very strict latency requirement */
 	if (unlikely(latency_req == 0)) {
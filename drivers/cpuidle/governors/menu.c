@@ -238,6 +238,9 @@ static int menu_select(struct cpuidle_device *dev)
 	int i;
 	int multiplier;
 	struct timespec t;
+	unsigned int rt_sleep_us;
+	int rt_latency_us;
+	bool rt_hint;
 
 	if (data->needs_update) {
 		menu_update(dev);
@@ -247,6 +250,15 @@ static int menu_select(struct cpuidle_device *dev)
 	data->last_state_idx = 0;
 	data->exit_us = 0;
 
+	/*
+	 * A real-time job released by a timer the tick code does not know
+	 * about (e.g. in the I-pipe head domain) ends the idle period, and
+	 * must not start later than its budget allows.
+	 */
+	rt_hint = !cpuidle_rt_constraint(dev->cpu, &rt_sleep_us, &rt_latency_us);
+	if (rt_hint && rt_latency_us >= 0 && rt_latency_us < latency_req)
+		latency_req = rt_latency_us;
+
 	/* Special case when user has set very strict latency requirement */
 	if (unlikely(latency_req == 0))
 		return 0;
@@ -255,6 +267,8 @@ static int menu_select(struct cpuidle_device *dev)
 	t = ktime_to_timespec(tick_nohz_get_sleep_length());
 	data->expected_us =
 		t.tv_sec * USEC_PER_SEC + t.tv_nsec / NSEC_PER_USEC;
+	if (rt_hint && rt_sleep_us < data->expected_us)
+		data->expected_us = rt_sleep_us;
 
 
 	data->bucket = which_bucket(data->expected_us);
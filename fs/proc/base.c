@@ -83,6 +83,8 @@
 #include <linux/pid_namespace.h>
 #include <linux/fs_struct.h>
 #include <linux/slab.h>
+#include <linux/cpufreq_raw.h>
+#include <linux/math64.h>
 #include "internal.h"
 
 /* NOTE:
@@ -362,6 +364,46 @@ static int proc_pid_schedstat(struct task_struct *task, char *buffer)
 }
 #endif
 
+#ifdef CONFIG_CPU_FREQ
+/*
+ * Provides /proc/PID/raw_stats, the deadline statistics kept by the 'raw'
+ * cpufreq governor: jobs misses slack_min slack_avg slack_max (ns)
+ * freq_changes freq_changes_max
+ */
+static int proc_pid_raw_stats(struct task_struct *task, char *buffer)
+{
+	struct raw_job_stats *st = ACCESS_ONCE(task->raw_stats);
+
+	if (!st)
+		return sprintf(buffer, "0 0 0 0 0 0 0\n");
+	smp_read_barrier_depends();
+	return sprintf(buffer, "%llu %llu %lld %lld %lld %llu %u\n",
+			(unsigned long long)st->jobs,
+			(unsigned long long)st->misses,
+			(long long)st->slack_min,
+			st->jobs ? (long long)div64_s64(st->slack_sum, st->jobs) : 0LL,
+			(long long)st->slack_max,
+			(unsigned long long)st->freq_changes,
+			st->freq_changes_max);
+}
+#endif
+
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+/*
+ * Provides /proc/PID/cpufreq_residency: "<kHz> <ns>" per frequency
+ */
+static int proc_pid_cpufreq_residency(struct task_struct *task, char *buffer)
+{
+	struct cpufreq_task_residency *res = &task->cpufreq_residency;
+	int i, len = 0;
+
+	for (i = 0; i < CPUFREQ_TASK_STATES && res->freq[i]; i++)
+		len += sprintf(buffer + len, "%u %llu\n", res->freq[i],
+			       (unsigned long long)res->time_ns[i]);
+	return len;
+}
+#endif
+
 #ifdef CONFIG_LATENCYTOP
 static int lstats_show_proc(struct seq_file *m, void *v)
 {
@@ -2811,6 +2853,12 @@ static const struct pid_entry tgid_base_stuff[] = {
 #ifdef CONFIG_SCHEDSTATS
 	INF("schedstat",  S_IRUGO, proc_pid_schedstat),
 #endif
+#ifdef CONFIG_CPU_FREQ
+	INF("raw_stats",  S_IRUGO, proc_pid_raw_stats),
+#endif
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+	INF("cpufreq_residency", S_IRUGO, proc_pid_cpufreq_residency),
+#endif
 #ifdef CONFIG_LATENCYTOP
 	REG("latency",  S_IRUGO, proc_lstats_operations),
 #endif
@@ -3152,6 +3200,12 @@ static const struct pid_entry tid_base_stuff[] = {
 #ifdef CONFIG_SCHEDSTATS
 	INF("schedstat", S_IRUGO, proc_pid_schedstat),
 #endif
+#ifdef CONFIG_CPU_FREQ
+	INF("raw_stats",  S_IRUGO, proc_pid_raw_stats),
+#endif
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+	INF("cpufreq_residency", S_IRUGO, proc_pid_cpufreq_residency),
+#endif
 #ifdef CONFIG_LATENCYTOP
 	REG("latency",  S_IRUGO, proc_lstats_operations),
 #endif
@@ -102,6 +102,10 @@ struct cpufreq_policy {
 
 	struct cpufreq_real_policy	user_policy;
 
+	struct mutex		target_mutex; /* serializes ->target() */
+	unsigned long		switch_lock; /* bit 0: ->target() or
+					      * ->fast_switch() running */
+
 	struct kobject		kobj;
 	struct completion	kobj_unregister;
 };
@@ -191,6 +195,9 @@ extern int cpufreq_driver_target(struct cpufreq_policy *policy,
 extern int __cpufreq_driver_target(struct cpufreq_policy *policy,
 				   unsigned int target_freq,
 				   unsigned int relation);
+extern unsigned int cpufreq_driver_fast_switch(struct cpufreq_policy *policy,
+					       unsigned int target_freq);
+extern int cpufreq_driver_read_perf(u64 *actual, u64 *reference);
 
 
 extern int __cpufreq_driver_getavg(struct cpufreq_policy *policy,
@@ -227,9 +234,20 @@ struct cpufreq_driver {
 	/* should be defined, if possible */
 	unsigned int	(*get)	(unsigned int cpu);
 
+	/* optional: like ->target() with CPUFREQ_RELATION_L, but callable
+	 * with interrupts off on one of policy->cpus. Must not sleep or
+	 * send transition notifications; returns the new frequency or 0
+	 * if the switch is not possible from this context. */
+	unsigned int	(*fast_switch)	(struct cpufreq_policy *policy,
+					 unsigned int target_freq);
+
 	/* optional */
 	unsigned int (*getavg)	(struct cpufreq_policy *policy,
 				 unsigned int cpu);
+	/* optional: free running cycle counters of the calling CPU, both
+	 * advancing only in C0: actual at the current frequency, reference
+	 * at cpuinfo.max_freq. Called with interrupts off; must not sleep. */
+	void	(*read_perf)	(u64 *actual, u64 *reference);
 	int	(*bios_limit)	(int cpu, unsigned int *limit);
 
 	int	(*exit)		(struct cpufreq_policy *policy);
@@ -247,6 +265,9 @@ struct cpufreq_driver {
 					 * frequency transitions */
 #define CPUFREQ_PM_NO_WARN	0x04	/* don't warn on suspend/resume speed
 					 * mismatches */
+#define CPUFREQ_NOTIFY_DEFERRED	0x80	/* only in cpufreq_freqs.flags: late
+					 * notification of fast switches, the
+					 * PRE/POSTCHANGE pair is not timed */
 
 int cpufreq_register_driver(struct cpufreq_driver *driver_data);
 int cpufreq_unregister_driver(struct cpufreq_driver *driver_data);
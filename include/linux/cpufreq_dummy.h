@@ -0,0 +1,44 @@
+/*
+ * linux/include/linux/cpufreq_dummy.h
+ *
+ * Software cpufreq driver used to exercise frequency policies on machines
+ * (or virtual machines) without a real P-state interface.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _LINUX_CPUFREQ_DUMMY_H
+#define _LINUX_CPUFREQ_DUMMY_H
+
+#include <linux/types.h>
+
+#define CPUFREQ_DUMMY_MAX_STATES	16
+
+/*
+ * One operating point of the emulated CPU and the time the CPU spent in it
+ * since the driver was bound: busy_ns counts time spent retiring virtual
+ * cycles, resid_ns counts total residency (busy + idle).
+ */
+struct cpufreq_dummy_state {
+	unsigned int	freq;		/* kHz */
+	unsigned int	voltage;	/* mV */
+	u64		busy_ns;
+	u64		resid_ns;
+};
+
+/*
+ * Retire @cycles virtual cycles on the current CPU, spinning for as long as
+ * the emulated frequency requires. Returns the wall time spent, in ns.
+ */
+extern u64 cpufreq_dummy_run_cycles(u64 cycles);
+
+/*
+ * Copy the operating points of @cpu, with residency accounted up to now,
+ * into @state. Returns the number of states copied or a negative errno.
+ */
+extern int cpufreq_dummy_snapshot(unsigned int cpu,
+				  struct cpufreq_dummy_state *state,
+				  unsigned int nstates);
+
+#endif /* _LINUX_CPUFREQ_DUMMY_H */
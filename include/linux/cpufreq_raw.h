@@ -0,0 +1,127 @@
+#ifndef _LINUX_CPUFREQ_RAW_H
+#define _LINUX_CPUFREQ_RAW_H
+
+#include <linux/types.h>
+
+/*
+ * Per-task control block shared between a real-time task and the 'raw'
+ * cpufreq governor.
+ *
+ * A task opens /dev/raw_gov and mmap()s one page of it; the page starts
+ * with a struct raw_task_ctl. At its path checkpoints the task publishes
+ * the remaining worst case execution cycles and its deadline with plain
+ * stores, following the seqcount protocol:
+ *
+ *	ctl->seq++;		(odd: update in progress)
+ *	write barrier
+ *	ctl->rwcec = ...; ctl->deadline_ns = ...; ...
+ *	write barrier
+ *	ctl->seq++;		(even: record is consistent)
+ *
+ * The governor reads the record when the task returns from preemption
+ * and retries while seq is odd or changes under it.
+ */
+
+#define RAW_CTL_VERSION		1
+
+/* flags */
+#define RAW_CTL_VALID		0x1	/* the record has been published */
+
+/*
+ * policy: how the governor spends the slack of the task's jobs.
+ * STRETCH runs at the lowest frequency that meets the deadline, RACE runs
+ * at the highest one and leaves the CPU idle until the next release, AUTO
+ * picks the cheaper of the two from the frequency sensitivity measured
+ * over the previous jobs.
+ */
+#define RAW_POLICY_STRETCH	0
+#define RAW_POLICY_RACE		1
+#define RAW_POLICY_AUTO		2
+
+struct raw_task_ctl {
+	__u32	seq;
+	__u32	version;	/* RAW_CTL_VERSION, written by the kernel */
+	__u32	flags;
+	__u32	state;		/* TASK_PERIOD_* of the current job */
+	__u64	rwcec;		/* remaining worst case execution cycles */
+	__u64	deadline_ns;	/* absolute deadline, RTAI time base */
+	__u32	min_freq;	/* kHz, 0 if none */
+	__u32	policy;		/* RAW_POLICY_*, formerly reserved (0) */
+};
+
+#ifdef __KERNEL__
+
+/*
+ * Execution history of a task, kept by the 'raw' governor: actual cycles
+ * consumed by the last RAW_PROFILE_JOBS jobs. Allocated by the governor the
+ * first time a job of the task completes, freed with the task.
+ */
+#define RAW_PROFILE_JOBS	16
+
+struct raw_stall_counter;
+
+struct raw_task_profile {
+	unsigned int	next;		/* slot of the next job */
+	unsigned int	count;		/* valid slots */
+	__u64		sum;		/* sum of the valid slots */
+	__u64		cycles[RAW_PROFILE_JOBS];
+
+	/*
+	 * Frequency sensitivity. aperf/mperf accumulate the CPU cycle
+	 * counters (cpufreq_driver_read_perf()) while the task runs; each
+	 * job leaves its average frequency and actual cycles in perf_*.
+	 * Fitting cycles = C + mem_ns * freq splits the runtime at
+	 * cpuinfo.max_freq into comp_ns, which scales with frequency, and
+	 * mem_ns, which does not. sensitivity is comp_ns in per mille of the
+	 * runtime, -1 while the jobs did not run at frequencies far enough
+	 * apart. race is the policy chosen for the next jobs.
+	 */
+	__u64		aperf;
+	__u64		mperf;
+	unsigned int	perf_next;
+	unsigned int	perf_count;
+	__u32		perf_freq[RAW_PROFILE_JOBS];	/* kHz */
+	__u64		perf_cycles[RAW_PROFILE_JOBS];
+	__u64		comp_ns;
+	__u64		mem_ns;
+	int		sensitivity;
+	int		race;
+
+	/*
+	 * Memory stalls, with cpufreq/raw/stall_event set: stall holds the
+	 * task's perf counters (cycles and stalled cycles). Each job leaves
+	 * in stall_pm the per mille of its cycles, scaled to
+	 * cpuinfo.max_freq, that were stalled; stall_permille is the
+	 * smallest over the recorded jobs, 0 until enough jobs were seen.
+	 * stall_exited is set once the task exits and no counter may be
+	 * attached any more.
+	 */
+	struct raw_stall_counter *stall;
+	unsigned int	stall_next;
+	unsigned int	stall_count;
+	__u16		stall_pm[RAW_PROFILE_JOBS];
+	unsigned int	stall_permille;
+	unsigned int	stall_exited;
+};
+
+/*
+ * Deadline statistics of the jobs tracked by the 'raw' governor, kept per
+ * task (allocated like the profile, freed with the task) and per policy.
+ * Slack is deadline - completion in ns, negative for a late job. A job
+ * still running at its deadline counts as a miss but has no slack.
+ */
+struct raw_job_stats {
+	__u64		jobs;		/* jobs completed */
+	__u64		misses;		/* deadlines missed */
+	__s64		slack_min;
+	__s64		slack_max;
+	__s64		slack_sum;	/* over the completed jobs */
+	__u64		freq_changes;	/* while the jobs were tracked */
+	__u32		freq_changes_max;	/* most changes within one job */
+	__u64		last_deadline_ns;	/* sched_clock() base */
+	__u64		period_ns;	/* between the last two deadlines */
+};
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_CPUFREQ_RAW_H */
@@ -183,6 +183,49 @@ static inline void cpuidle_unregister_governor(struct cpuidle_governor *gov) { }
 
 #endif
 
+/*****************************
+ * CPUIDLE REAL-TIME HINTS   *
+ *****************************/
+
+/**
+ * struct cpuidle_rt_hint - next real-time event of a CPU
+ * @wakeup_ns: ktime_get() of the next known job release, in ns, 0 if none
+ * @latency_us: exit latency that job tolerates, PM_QOS_DEFAULT_VALUE if any
+ *
+ * Published by whoever knows the real-time schedule of a CPU (e.g. a
+ * cpufreq governor driving RT tasks) so that the idle governors neither
+ * predict a residency past the next release nor pick a state whose exit
+ * latency would eat into the budget of the job. Requests on one CPU are
+ * aggregated like pm_qos: earliest wake-up, smallest latency.
+ */
+struct cpuidle_rt_hint {
+	struct list_head	node;
+	int			cpu;
+	u64			wakeup_ns;
+	s32			latency_us;
+};
+
+#ifdef CONFIG_CPU_IDLE
+
+extern void cpuidle_rt_hint_add(struct cpuidle_rt_hint *hint, int cpu);
+extern void cpuidle_rt_hint_update(struct cpuidle_rt_hint *hint,
+				   u64 wakeup_ns, s32 latency_us);
+extern void cpuidle_rt_hint_remove(struct cpuidle_rt_hint *hint);
+extern int cpuidle_rt_constraint(int cpu, unsigned int *sleep_us,
+				 int *latency_us);
+
+#else
+
+static inline void cpuidle_rt_hint_add(struct cpuidle_rt_hint *hint, int cpu) { }
+static inline void cpuidle_rt_hint_update(struct cpuidle_rt_hint *hint,
+					  u64 wakeup_ns, s32 latency_us) { }
+static inline void cpuidle_rt_hint_remove(struct cpuidle_rt_hint *hint) { }
+static inline int cpuidle_rt_constraint(int cpu, unsigned int *sleep_us,
+					int *latency_us)
+{return -ENODEV; }
+
+#endif
+
 #ifdef CONFIG_ARCH_HAS_CPU_RELAX
 #define CPUIDLE_DRIVER_STATE_START	1
 #else
@@ -27,6 +27,7 @@
 #include <linux/percpu.h>
 #include <linux/mutex.h>
 #include <linux/linkage.h>
+#include <linux/errno.h>
 #include <linux/ipipe_base.h>
 #include <asm/ipipe.h>
 #include <asm/bug.h>
@@ -162,6 +163,12 @@ struct ipipe_domain {
 		ipipe_irq_ackfn_t acknowledge;
 		ipipe_irq_handler_t handler;
 		void *cookie;
+#ifdef CONFIG_IPIPE_IRQLOG
+		unsigned int prio;
+#endif
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+		unsigned long long coalesce; /* Min. replay interval (TSC) */
+#endif
 	} ____cacheline_aligned irqs[IPIPE_NR_IRQS];
 
 	int priority;
@@ -285,7 +292,107 @@ static inline void ipipe_irq_unlock(unsigned irq)
 
 #define __ipipe_pipeline_head_p(ipd) (&(ipd)->p_link == __ipipe_pipeline.next)
 
-#define __ipipe_ipending_p(p)	((p)->irqpend_himap != 0)
+#ifdef CONFIG_IPIPE_IRQLOG
+#define __ipipe_logged_p(p)	((p)->irqpend_prio != 0)
+#else
+#define __ipipe_logged_p(p)	((p)->irqpend_himap != 0)
+#endif
+
+/*
+ * IRQs held back by coalescing (CONFIG_IPIPE_ROOT_BATCH) do not count:
+ * a timer logs them again once they are due.
+ */
+#define __ipipe_ipending_p(p)	__ipipe_logged_p(p)
+
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+
+/* Must be called hw IRQs off, on entry of the pipeline. */
+static inline void __ipipe_latency_entry(void)
+{
+	ipipe_read_tsc(__ipipe_get_cpu_var(ipipe_latency_data).entry);
+}
+
+static inline void __ipipe_latency_add(int hist, unsigned long long since)
+{
+	struct ipipe_latency_data *l = &__ipipe_get_cpu_var(ipipe_latency_data);
+	unsigned long long now;
+	int b;
+
+	ipipe_read_tsc(now);
+	b = fls64(now - since);
+	if (b >= IPIPE_LAT_BUCKETS)
+		b = IPIPE_LAT_BUCKETS - 1;
+	l->hist[hist][b]++;
+}
+
+/*
+ * Must be called hw IRQs off, when @irq gets logged for @ipd. An IRQ
+ * logged again before being played keeps its first stamp.
+ */
+static inline void __ipipe_latency_log(struct ipipe_domain *ipd,
+				       struct ipipe_percpu_domain_data *p,
+				       unsigned int irq)
+{
+	struct ipipe_latency_data *l;
+
+	if (p->irqstamp[irq])
+		return;
+
+	ipipe_read_tsc(p->irqstamp[irq]);
+
+	if (ipd == ipipe_root_domain &&
+	    test_bit(IPIPE_STALL_FLAG, &p->status)) {
+		l = &__ipipe_get_cpu_var(ipipe_latency_data);
+		if (l->stall == 0)
+			l->stall = p->irqstamp[irq];
+	}
+}
+
+/* Must be called hw IRQs off, when @ipd plays @irq from its log. */
+static inline void __ipipe_latency_replay(struct ipipe_domain *ipd,
+					  struct ipipe_percpu_domain_data *p,
+					  unsigned int irq)
+{
+	unsigned long long since = p->irqstamp[irq];
+
+	if (since == 0)
+		return;
+
+	p->irqstamp[irq] = 0;
+
+	if (ipd == ipipe_root_domain)
+		__ipipe_latency_add(IPIPE_LAT_ROOTREPLAY, since);
+	else if (__ipipe_pipeline_head_p(ipd))
+		__ipipe_latency_add(IPIPE_LAT_IRQ2HEAD, since);
+}
+
+/* Must be called hw IRQs off, when the root stage starts syncing. */
+static inline void __ipipe_latency_root_sync(void)
+{
+	struct ipipe_latency_data *l = &__ipipe_get_cpu_var(ipipe_latency_data);
+
+	if (l->stall) {
+		__ipipe_latency_add(IPIPE_LAT_ROOTSTALL, l->stall);
+		l->stall = 0;
+	}
+}
+
+/* Must be called hw IRQs off, before a wired IRQ reaches its handler. */
+static inline void __ipipe_latency_wired(void)
+{
+	__ipipe_latency_add(IPIPE_LAT_IRQ2HEAD,
+			    __ipipe_get_cpu_var(ipipe_latency_data).entry);
+}
+
+#else /* !CONFIG_IPIPE_LATENCY_HIST */
+
+#define __ipipe_latency_entry()			do { } while (0)
+#define __ipipe_latency_log(ipd, p, irq)	do { } while (0)
+#define __ipipe_latency_replay(ipd, p, irq)	do { } while (0)
+#define __ipipe_latency_root_sync()		do { } while (0)
+#define __ipipe_latency_wired()			do { } while (0)
+
+#endif /* !CONFIG_IPIPE_LATENCY_HIST */
 
 /*
  * Keep the following as a macro, so that client code could check for
@@ -442,6 +549,34 @@ int ipipe_free_virq(unsigned virq);
 
 int ipipe_trigger_irq(unsigned irq);
 
+#ifdef CONFIG_IPIPE_IRQLOG
+int ipipe_set_irq_priority(struct ipipe_domain *ipd,
+			   unsigned int irq,
+			   unsigned int prio);
+#else
+static inline int ipipe_set_irq_priority(struct ipipe_domain *ipd,
+					 unsigned int irq,
+					 unsigned int prio)
+{
+	return -ENOSYS;
+}
+#endif
+
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+#define IPIPE_COALESCE_MAX_NS	1000000	/* 1 ms */
+
+int ipipe_set_irq_coalescing(struct ipipe_domain *ipd,
+			     unsigned int irq,
+			     unsigned long ns);
+#else
+static inline int ipipe_set_irq_coalescing(struct ipipe_domain *ipd,
+					   unsigned int irq,
+					   unsigned long ns)
+{
+	return -ENOSYS;
+}
+#endif
+
 static inline void __ipipe_propagate_irq(unsigned irq)
 {
 	struct list_head *next = __ipipe_current_domain->p_link.next;
@@ -575,6 +710,9 @@ void __ipipe_do_critical_sync(unsigned irq, void *cookie);
 
 unsigned long ipipe_critical_enter(void (*syncfn) (void));
 
+unsigned long ipipe_critical_enter_mask(void (*syncfn) (void),
+					const struct cpumask *mask);
+
 void ipipe_critical_exit(unsigned long flags);
 
 void ipipe_prepare_panic(void);
@@ -51,6 +51,19 @@
 #define __IPIPE_2LEVEL_IRQMAP	1
 #endif
 
+#ifdef CONFIG_IPIPE_IRQLOG
+/*
+ * The O(1) interrupt log threads pending IRQs through one FIFO per
+ * priority class. Bits 0 to IPIPE_IRQ_NRPRIO-1 of the per-stage
+ * irqpend_prio word flag non-empty classes, the two bits above track
+ * the root replay batch and a pending relink request.
+ */
+#define IPIPE_IRQ_NRPRIO	8
+#define IPIPE_IRQLOG_BATCH	IPIPE_IRQ_NRPRIO
+#define IPIPE_IRQLOG_RESCAN	(IPIPE_IRQ_NRPRIO + 1)
+#define IPIPE_IRQLOG_CLASSES	((1UL << IPIPE_IRQ_NRPRIO) - 1)
+#endif
+
 /* Per-cpu pipeline status */
 #define IPIPE_STALL_FLAG	0	/* Stalls a pipeline stage -- guaranteed at bit #0 */
 #define IPIPE_NOSTACK_FLAG	1	/* Domain currently runs on a foreign stack */
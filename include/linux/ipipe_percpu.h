@@ -29,16 +29,50 @@ struct ipipe_domain;
 
 struct ipipe_percpu_domain_data {
 	unsigned long status;	/* <= Must be first in struct. */
+#ifdef CONFIG_IPIPE_IRQLOG
+	unsigned long irqpend_prio;
+	/* List links hold irq + 1, so that a cleared stage is empty. */
+	unsigned short irqlog_head[IPIPE_IRQ_NRPRIO + 1];
+	unsigned short irqlog_tail[IPIPE_IRQ_NRPRIO];
+	unsigned short irqlog_next[IPIPE_NR_IRQS];
+	unsigned long irqlog_map[IPIPE_IRQ_LOMAPSZ];
+#else
 	unsigned long irqpend_himap;
 #ifdef __IPIPE_3LEVEL_IRQMAP
 	unsigned long irqpend_mdmap[IPIPE_IRQ_MDMAPSZ];
+#endif
 #endif
 	unsigned long irqpend_lomap[IPIPE_IRQ_LOMAPSZ];
 	unsigned long irqheld_map[IPIPE_IRQ_LOMAPSZ];
 	unsigned long irqall[IPIPE_NR_IRQS];
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+	unsigned long long irqstamp[IPIPE_NR_IRQS]; /* TSC when logged */
+#endif
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+	unsigned long irqdefer;	/* # of IRQs held back by coalescing */
+	unsigned long long irqdefer_due; /* TSC when the first one is due */
+	unsigned long irqdefer_map[IPIPE_IRQ_LOMAPSZ];
+	unsigned long long irqreplay[IPIPE_NR_IRQS]; /* TSC when last played */
+#endif
 	u64 evsync;
 };
 
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+
+#define IPIPE_LAT_IRQ2HEAD	0	/* pipeline entry -> head handler */
+#define IPIPE_LAT_ROOTREPLAY	1	/* logged for root -> root handler */
+#define IPIPE_LAT_ROOTSTALL	2	/* IRQ finds root stalled -> root sync */
+#define IPIPE_LAT_NR		3
+#define IPIPE_LAT_BUCKETS	32	/* log2 of the delay in TSC ticks */
+
+struct ipipe_latency_data {
+	unsigned long long entry;	/* TSC at the last pipeline entry */
+	unsigned long long stall;	/* TSC of the first IRQ held by root */
+	unsigned long hist[IPIPE_LAT_NR][IPIPE_LAT_BUCKETS];
+};
+
+#endif /* CONFIG_IPIPE_LATENCY_HIST */
+
 /*
  * CAREFUL: all accessors based on __raw_get_cpu_var() you may find in
  * this file should be used only while hw interrupts are off, to
@@ -68,6 +102,10 @@ DECLARE_PER_CPU(struct ipipe_domain *, ipipe_percpu_domain);
 
 DECLARE_PER_CPU(unsigned long, ipipe_nmi_saved_root);
 
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+DECLARE_PER_CPU(struct ipipe_latency_data, ipipe_latency_data);
+#endif
+
 #ifdef CONFIG_IPIPE_DEBUG_CONTEXT
 DECLARE_PER_CPU(int, ipipe_percpu_context_check);
 DECLARE_PER_CPU(int, ipipe_saved_context_check_state);
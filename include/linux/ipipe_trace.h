@@ -27,6 +27,21 @@
 
 #include <linux/types.h>
 
+/*
+ * Binary record read from /proc/ipipe/trace/stream/cpuN. @lost is
+ * the number of points dropped on that CPU right before this one,
+ * because the stream ring was full.
+ */
+struct ipipe_trace_record {
+	__u64 timestamp;
+	__u64 eip;
+	__u64 parent_eip;
+	__u64 v;
+	__u32 lost;
+	__u16 type;
+	__u16 flags;
+};
+
 void ipipe_trace_begin(unsigned long v);
 void ipipe_trace_end(unsigned long v);
 void ipipe_trace_freeze(unsigned long v);
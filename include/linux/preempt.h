@@ -138,6 +138,8 @@ struct preempt_notifier {
 
 void preempt_notifier_register(struct preempt_notifier *notifier);
 void preempt_notifier_unregister(struct preempt_notifier *notifier);
+void preempt_notifier_register_global(struct preempt_notifier *notifier);
+void preempt_notifier_unregister_global(struct preempt_notifier *notifier);
 
 static inline void preempt_notifier_init(struct preempt_notifier *notifier,
 				     struct preempt_ops *ops)
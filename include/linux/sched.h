@@ -1221,6 +1221,22 @@ struct sched_rt_entity {
 };
 
 struct rcu_node;
+struct raw_task_ctl;
+struct raw_task_profile;
+struct raw_job_stats;
+
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+#define CPUFREQ_TASK_STATES	16
+
+/*
+ * Time the task ran at each CPU frequency, filled in by cpufreq_stats at
+ * every context switch and shown in /proc/<pid>/cpufreq_residency.
+ */
+struct cpufreq_task_residency {
+	unsigned int freq[CPUFREQ_TASK_STATES];	/* kHz, 0 = unused slot */
+	u64 time_ns[CPUFREQ_TASK_STATES];
+};
+#endif
 
 enum perf_event_task_context {
 	perf_invalid_context = -1,
@@ -1257,7 +1273,14 @@ struct task_struct {
 	unsigned int cpu_voltage;
 	unsigned int last_cpu_frequency;
 	unsigned int last_cpu_voltage;
+	struct raw_task_ctl __rcu *raw_ctl; // Bloco de controle compartilhado com a tarefa (/dev/raw_gov)... NULL se nao houver.
+	struct raw_task_profile *raw_profile; // Historico de ciclos consumidos por job (ACEC)... alocado pelo RAW GOVERNOR.
+	struct raw_job_stats *raw_stats; // Deadlines cumpridos/perdidos e folga dos jobs... alocado pelo RAW GOVERNOR.
+	unsigned long long raw_job_end_ns; // sched_clock() da primeira troca de contexto apos o fim do job.
 	/* TODO:RAWLINSON - FIM DAS DEFINICOES...*/
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+	struct cpufreq_task_residency cpufreq_residency;
+#endif
 
 	int lock_depth;		/* BKL lock depth */
 
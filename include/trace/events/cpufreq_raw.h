@@ -0,0 +1,146 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_raw
+
+#if !defined(_TRACE_CPUFREQ_RAW_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_RAW_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Tracepoints for the decisions taken by the 'raw' cpufreq governor
+ * (drivers/cpufreq/cpufreq_raw.c).
+ */
+
+TRACE_EVENT(raw_gov_signal,
+
+	TP_PROTO(unsigned int cpu, pid_t pid, unsigned long long tick_ns,
+		 unsigned long long deadline_ns),
+
+	TP_ARGS(cpu, pid, tick_ns, deadline_ns),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu		)
+		__field(	pid_t,		pid		)
+		__field(	u64,		tick_ns		)
+		__field(	u64,		deadline_ns	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->pid		= pid;
+		__entry->tick_ns	= tick_ns;
+		__entry->deadline_ns	= deadline_ns;
+	),
+
+	TP_printk("cpu=%u pid=%d tick=%llu deadline=%llu",
+		  __entry->cpu, __entry->pid,
+		  (unsigned long long)__entry->tick_ns,
+		  (unsigned long long)__entry->deadline_ns)
+);
+
+TRACE_EVENT(raw_gov_calc_freq,
+
+	TP_PROTO(unsigned int cpu, pid_t pid, unsigned long rwcec,
+		 long long remaining_ns, long long monitor_delay_ns,
+		 unsigned int freq, bool deadline_violated),
+
+	TP_ARGS(cpu, pid, rwcec, remaining_ns, monitor_delay_ns, freq,
+		deadline_violated),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu			)
+		__field(	pid_t,		pid			)
+		__field(	unsigned long,	rwcec			)
+		__field(	s64,		remaining_ns		)
+		__field(	s64,		monitor_delay_ns	)
+		__field(	u32,		freq			)
+		__field(	bool,		deadline_violated	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu			= cpu;
+		__entry->pid			= pid;
+		__entry->rwcec			= rwcec;
+		__entry->remaining_ns		= remaining_ns;
+		__entry->monitor_delay_ns	= monitor_delay_ns;
+		__entry->freq			= freq;
+		__entry->deadline_violated	= deadline_violated;
+	),
+
+	TP_printk("cpu=%u pid=%d rwcec=%lu remaining=%lld delay=%lld freq=%u%s",
+		  __entry->cpu, __entry->pid, __entry->rwcec,
+		  (long long)__entry->remaining_ns,
+		  (long long)__entry->monitor_delay_ns, __entry->freq,
+		  __entry->deadline_violated ? " DEADLINE_VIOLATED" : "")
+);
+
+TRACE_EVENT(raw_gov_table_target,
+
+	TP_PROTO(unsigned int cpu, unsigned int target_freq, unsigned int freq),
+
+	TP_ARGS(cpu, target_freq, freq),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu		)
+		__field(	u32,		target_freq	)
+		__field(	u32,		freq		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->target_freq	= target_freq;
+		__entry->freq		= freq;
+	),
+
+	TP_printk("cpu=%u target=%u freq=%u",
+		  __entry->cpu, __entry->target_freq, __entry->freq)
+);
+
+DECLARE_EVENT_CLASS(raw_gov_transition,
+
+	TP_PROTO(unsigned int cpu, pid_t pid, unsigned int requested,
+		 unsigned int freq),
+
+	TP_ARGS(cpu, pid, requested, freq),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu		)
+		__field(	pid_t,		pid		)
+		__field(	u32,		requested	)
+		__field(	u32,		freq		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->pid		= pid;
+		__entry->requested	= requested;
+		__entry->freq		= freq;
+	),
+
+	TP_printk("cpu=%u pid=%d requested=%u freq=%u",
+		  __entry->cpu, __entry->pid, __entry->requested,
+		  __entry->freq)
+);
+
+/* frequency set on behalf of a task through ->set_frequency() */
+DEFINE_EVENT(raw_gov_transition, raw_gov_set_frequency,
+
+	TP_PROTO(unsigned int cpu, pid_t pid, unsigned int requested,
+		 unsigned int freq),
+
+	TP_ARGS(cpu, pid, requested, freq)
+);
+
+/* frequency set by the raw monitor after a preemption return */
+DEFINE_EVENT(raw_gov_transition, raw_gov_work,
+
+	TP_PROTO(unsigned int cpu, pid_t pid, unsigned int requested,
+		 unsigned int freq),
+
+	TP_ARGS(cpu, pid, requested, freq)
+);
+
+#endif /* _TRACE_CPUFREQ_RAW_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -163,6 +163,8 @@ void free_task(struct task_struct *tsk)
 	free_thread_info(tsk->stack);
 	rt_mutex_debug_task_free(tsk);
 	ftrace_graph_exit_task(tsk);
+	kfree(tsk->raw_profile);
+	kfree(tsk->raw_stats);
 	free_task_struct(tsk);
 }
 EXPORT_SYMBOL(free_task);
@@ -290,6 +292,8 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	tsk->btrace_seq = 0;
 #endif
 	tsk->splice_pipe = NULL;
+	tsk->raw_profile = NULL;	/* liberado em free_task() */
+	tsk->raw_stats = NULL;		/* liberado em free_task() */
 
 	account_kernel_stack(ti, 1);
 
@@ -1091,6 +1095,11 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	p->cpu_voltage = 0;
 	p->last_cpu_frequency = 0;
 	p->last_cpu_voltage = 0;
+	p->raw_ctl = NULL;
+	p->raw_job_end_ns = 0;
+#ifdef CONFIG_CPU_FREQ_STAT_TASK
+	memset(&p->cpufreq_residency, 0, sizeof(p->cpufreq_residency));
+#endif
 	p->cpus_allowed = cpumask_of_cpu(CPUID_PADRAO);
 
 	p->utime = cputime_zero;
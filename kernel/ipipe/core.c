@@ -31,13 +31,18 @@
 #include <linux/interrupt.h>
 #include <linux/bitops.h>
 #include <linux/tick.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 #ifdef CONFIG_PROC_FS
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/ctype.h>
+#include <linux/uaccess.h>
 #endif	/* CONFIG_PROC_FS */
 #include <linux/ipipe_trace.h>
 #include <linux/ipipe_tickdev.h>
 #include <linux/irq.h>
+#include <linux/rculist.h>
 
 static int __ipipe_ptd_key_count;
 
@@ -57,6 +62,12 @@ static cpumask_t __ipipe_cpu_lock_map;
 
 static cpumask_t __ipipe_cpu_pass_map;
 
+/* CPUs held by the current critical section, requestor excluded. */
+static cpumask_t __ipipe_cpu_target_map;
+
+/* Scratch mask, only used by the owner of the superlock. */
+static cpumask_t __ipipe_cpu_scratch_map;
+
 static unsigned long __ipipe_critical_lock;
 
 static IPIPE_DEFINE_SPINLOCK(__ipipe_cpu_barrier);
@@ -102,6 +113,10 @@ DEFINE_PER_CPU(struct ipipe_domain *, ipipe_percpu_domain) = { &ipipe_root };
 
 DEFINE_PER_CPU(unsigned long, ipipe_nmi_saved_root); /* Copy of root status during NMI */
 
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+DEFINE_PER_CPU(struct ipipe_latency_data, ipipe_latency_data);
+#endif
+
 static IPIPE_DEFINE_SPINLOCK(__ipipe_pipelock);
 
 LIST_HEAD(__ipipe_pipeline);
@@ -140,7 +155,8 @@ int ipipe_request_tickdev(const char *devname,
 	unsigned long flags;
 	int status;
 
-	flags = ipipe_critical_enter(NULL);
+	/* Only the CPU owning the tick device may be running its handlers. */
+	flags = ipipe_critical_enter_mask(NULL, cpumask_of(cpu));
 
 	itd = &per_cpu(ipipe_tick_cpu_device, cpu);
 
@@ -209,7 +225,7 @@ void ipipe_release_tickdev(int cpu)
 	struct clock_event_device *evtdev;
 	unsigned long flags;
 
-	flags = ipipe_critical_enter(NULL);
+	flags = ipipe_critical_enter_mask(NULL, cpumask_of(cpu));
 
 	itd = &per_cpu(ipipe_tick_cpu_device, cpu);
 
@@ -290,10 +306,21 @@ void __ipipe_init_stage(struct ipipe_domain *ipd)
 		p->status = status;
 	}
 
+#ifdef CONFIG_IPIPE_IRQLOG
+	/* Log links are 16bit wide and hold irq + 1. */
+	BUILD_BUG_ON(IPIPE_NR_IRQS >= 65536);
+#endif
+
 	for (n = 0; n < IPIPE_NR_IRQS; n++) {
 		ipd->irqs[n].acknowledge = NULL;
 		ipd->irqs[n].handler = NULL;
 		ipd->irqs[n].control = IPIPE_PASS_MASK;	/* Pass but don't handle */
+#ifdef CONFIG_IPIPE_IRQLOG
+		ipd->irqs[n].prio = 0;
+#endif
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+		ipd->irqs[n].coalesce = 0;
+#endif
 	}
 
 	for (n = 0; n < IPIPE_NR_EVENTS; n++)
@@ -556,31 +583,238 @@ void __ipipe_spin_unlock_irqcomplete(unsigned long x)
 	local_irq_restore_hw(x);
 }
 
-#ifdef __IPIPE_3LEVEL_IRQMAP
+#ifdef CONFIG_IPIPE_IRQLOG
 
-/* Must be called hw IRQs off. */
-static inline void __ipipe_set_irq_held(struct ipipe_percpu_domain_data *p,
-					unsigned int irq)
+/*
+ * O(1) interrupt log. Pending IRQs are queued to one FIFO per
+ * priority class, threaded through p->irqlog_next[], so that logging
+ * and picking the next IRQ never depend on the number of vectors.
+ *
+ * irqpend_lomap tells whether an IRQ is logically pending, irqlog_map
+ * whether it is currently linked into a list. Locking an IRQ only
+ * drops the former; the stale link is discarded when it reaches the
+ * head of its list. Only the owner CPU links or unlinks entries; a
+ * remote CPU unlocking an IRQ sets the pending bit and raises
+ * IPIPE_IRQLOG_RESCAN, so that the owner relinks it before replaying
+ * its log.
+ */
+
+/* Must be called hw IRQs off, on the CPU owning @p. */
+static inline void __ipipe_link_irq(struct ipipe_domain *ipd,
+				    struct ipipe_percpu_domain_data *p,
+				    unsigned int irq)
 {
-	set_bit(irq, p->irqheld_map);
-	p->irqall[irq]++;
+	unsigned int prio, tail;
+
+	if (__test_and_set_bit(irq, p->irqlog_map))
+		return;
+
+	prio = ipd->irqs[irq].prio;
+	p->irqlog_next[irq] = 0;
+	tail = p->irqlog_tail[prio];
+	if (tail)
+		p->irqlog_next[tail - 1] = irq + 1;
+	else {
+		p->irqlog_head[prio] = irq + 1;
+		set_bit(prio, &p->irqpend_prio);
+	}
+	p->irqlog_tail[prio] = irq + 1;
+}
+
+/* Must be called hw IRQs off, on the CPU owning @p. */
+static inline void __ipipe_log_irq(struct ipipe_domain *ipd,
+				   struct ipipe_percpu_domain_data *p,
+				   unsigned int irq)
+{
+	set_bit(irq, p->irqpend_lomap);
+	__ipipe_link_irq(ipd, p, irq);
+}
+
+static void __ipipe_relink_irqs(struct ipipe_domain *ipd,
+				struct ipipe_percpu_domain_data *p)
+{
+	unsigned long m;
+	int n;
+
+	clear_bit(IPIPE_IRQLOG_RESCAN, &p->irqpend_prio);
+	smp_mb__after_clear_bit();
+
+	for (n = 0; n < IPIPE_IRQ_LOMAPSZ; n++) {
+		m = p->irqpend_lomap[n] & ~p->irqlog_map[n];
+		while (m) {
+			__ipipe_link_irq(ipd, p, n * BITS_PER_LONG + __ffs(m));
+			m &= m - 1;
+		}
+	}
 }
 
 /* Must be called hw IRQs off. */
 void __ipipe_set_irq_pending(struct ipipe_domain *ipd, unsigned int irq)
 {
 	struct ipipe_percpu_domain_data *p = ipipe_cpudom_ptr(ipd);
-	int l0b, l1b;
 
 	IPIPE_WARN_ONCE(!irqs_disabled_hw());
 
+	if (likely(!test_bit(IPIPE_LOCK_FLAG, &ipd->irqs[irq].control))) {
+		__ipipe_log_irq(ipd, p, irq);
+		__ipipe_latency_log(ipd, p, irq);
+	} else
+		set_bit(irq, p->irqheld_map);
+
+	p->irqall[irq]++;
+}
+
+/* Must be called hw IRQs off. */
+void __ipipe_lock_irq(struct ipipe_domain *ipd, int cpu, unsigned int irq)
+{
+	struct ipipe_percpu_domain_data *p;
+
+	IPIPE_WARN_ONCE(!irqs_disabled_hw());
+
+	/* Wired interrupts cannot be locked (it is useless). */
+	if (test_bit(IPIPE_WIRED_FLAG, &ipd->irqs[irq].control) ||
+	    test_and_set_bit(IPIPE_LOCK_FLAG, &ipd->irqs[irq].control))
+		return;
+
+	p = ipipe_percpudom_ptr(ipd, cpu);
+	if (test_and_clear_bit(irq, p->irqpend_lomap))
+		set_bit(irq, p->irqheld_map);
+}
+
+/* Must be called hw IRQs off. */
+void __ipipe_unlock_irq(struct ipipe_domain *ipd, unsigned int irq)
+{
+	struct ipipe_percpu_domain_data *p;
+	int cpu;
+
+	IPIPE_WARN_ONCE(!irqs_disabled_hw());
+
+	if (unlikely(!test_and_clear_bit(IPIPE_LOCK_FLAG,
+					 &ipd->irqs[irq].control)))
+		return;
+
+	for_each_online_cpu(cpu) {
+		p = ipipe_percpudom_ptr(ipd, cpu);
+		if (test_and_clear_bit(irq, p->irqheld_map)) {
+			set_bit(irq, p->irqpend_lomap);
+			smp_wmb();
+			set_bit(IPIPE_IRQLOG_RESCAN, &p->irqpend_prio);
+		}
+	}
+}
+
+/*
+ * The root stage replays its log by batches: everything logged so
+ * far is detached at once, and IRQs logged while the batch is being
+ * played wait for the next one. This keeps the replay in arrival
+ * order and bounded, whatever the IRQ load. The batch stays attached
+ * to @p, so that a root handler migrating us to another CPU leaves
+ * the remainder to the CPU it was logged on.
+ */
+static inline int __ipipe_next_root_irq(struct ipipe_percpu_domain_data *p)
+{
+	unsigned int irq;
+
+	for (;;) {
+		if (p->irqlog_head[IPIPE_IRQLOG_BATCH] == 0) {
+			if (p->irqlog_head[0] == 0)
+				return -1;
+			p->irqlog_head[IPIPE_IRQLOG_BATCH] = p->irqlog_head[0];
+			p->irqlog_head[0] = p->irqlog_tail[0] = 0;
+			set_bit(IPIPE_IRQLOG_BATCH, &p->irqpend_prio);
+			clear_bit(0, &p->irqpend_prio);
+		}
+
+		irq = p->irqlog_head[IPIPE_IRQLOG_BATCH] - 1;
+		p->irqlog_head[IPIPE_IRQLOG_BATCH] = p->irqlog_next[irq];
+		if (p->irqlog_head[IPIPE_IRQLOG_BATCH] == 0)
+			clear_bit(IPIPE_IRQLOG_BATCH, &p->irqpend_prio);
+
+		__clear_bit(irq, p->irqlog_map);
+		if (test_and_clear_bit(irq, p->irqpend_lomap))
+			return irq;
+	}
+}
+
+static inline int __ipipe_next_irq(struct ipipe_domain *ipd,
+				   struct ipipe_percpu_domain_data *p)
+{
+	unsigned long classes;
+	unsigned int prio, irq;
+
+	if (unlikely(test_bit(IPIPE_IRQLOG_RESCAN, &p->irqpend_prio)))
+		__ipipe_relink_irqs(ipd, p);
+
+	if (ipd == ipipe_root_domain)
+		return __ipipe_next_root_irq(p);
+
+	for (;;) {
+		classes = p->irqpend_prio & IPIPE_IRQLOG_CLASSES;
+		if (classes == 0)
+			return -1;
+
+		prio = __fls(classes);
+		irq = p->irqlog_head[prio] - 1;
+		p->irqlog_head[prio] = p->irqlog_next[irq];
+		if (p->irqlog_head[prio] == 0) {
+			p->irqlog_tail[prio] = 0;
+			clear_bit(prio, &p->irqpend_prio);
+		}
+
+		__clear_bit(irq, p->irqlog_map);
+		if (test_and_clear_bit(irq, p->irqpend_lomap))
+			return irq;
+	}
+}
+
+/*
+ * ipipe_set_irq_priority() -- Set the replay priority of @irq in a
+ * non-root domain. When several IRQs are pending for the stage, the
+ * highest priority class is played first, FIFO within a class. The
+ * root domain always replays in arrival order.
+ */
+int ipipe_set_irq_priority(struct ipipe_domain *ipd,
+			   unsigned int irq,
+			   unsigned int prio)
+{
+	if (irq >= IPIPE_NR_IRQS || prio >= IPIPE_IRQ_NRPRIO)
+		return -EINVAL;
+
+	if (ipd == ipipe_root_domain)
+		return -EINVAL;
+
+	ipd->irqs[irq].prio = prio;
+
+	return 0;
+}
+
+#elif defined(__IPIPE_3LEVEL_IRQMAP)
+
+/* Must be called hw IRQs off. */
+static inline void __ipipe_log_irq(struct ipipe_domain *ipd,
+				   struct ipipe_percpu_domain_data *p,
+				   unsigned int irq)
+{
+	int l0b, l1b;
+
 	l0b = irq / (BITS_PER_LONG * BITS_PER_LONG);
 	l1b = irq / BITS_PER_LONG;
 
+	set_bit(irq, p->irqpend_lomap);
+	set_bit(l1b, p->irqpend_mdmap);
+	set_bit(l0b, &p->irqpend_himap);
+}
+
+/* Must be called hw IRQs off. */
+void __ipipe_set_irq_pending(struct ipipe_domain *ipd, unsigned int irq)
+{
+	struct ipipe_percpu_domain_data *p = ipipe_cpudom_ptr(ipd);
+
+	IPIPE_WARN_ONCE(!irqs_disabled_hw());
+
 	if (likely(!test_bit(IPIPE_LOCK_FLAG, &ipd->irqs[irq].control))) {
-		set_bit(irq, p->irqpend_lomap);
-		set_bit(l1b, p->irqpend_mdmap);
-		set_bit(l0b, &p->irqpend_himap);
+		__ipipe_log_irq(ipd, p, irq);
+		__ipipe_latency_log(ipd, p, irq);
 	} else
 		set_bit(irq, p->irqheld_map);
 
@@ -639,7 +873,8 @@ void __ipipe_unlock_irq(struct ipipe_domain *ipd, unsigned int irq)
 	}
 }
 
-static inline int __ipipe_next_irq(struct ipipe_percpu_domain_data *p)
+static inline int __ipipe_next_irq(struct ipipe_domain *ipd,
+				   struct ipipe_percpu_domain_data *p)
 {
 	int l0b, l1b, l2b;
 	unsigned long l0m, l1m, l2m;
@@ -675,24 +910,24 @@ static inline int __ipipe_next_irq(struct ipipe_percpu_domain_data *p)
 #else /* __IPIPE_2LEVEL_IRQMAP */
 
 /* Must be called hw IRQs off. */
-static inline void __ipipe_set_irq_held(struct ipipe_percpu_domain_data *p,
-					unsigned int irq)
+static inline void __ipipe_log_irq(struct ipipe_domain *ipd,
+				   struct ipipe_percpu_domain_data *p,
+				   unsigned irq)
 {
-	set_bit(irq, p->irqheld_map);
-	p->irqall[irq]++;
+	set_bit(irq, p->irqpend_lomap);
+	set_bit(irq / BITS_PER_LONG, &p->irqpend_himap);
 }
 
 /* Must be called hw IRQs off. */
 void __ipipe_set_irq_pending(struct ipipe_domain *ipd, unsigned irq)
 {
 	struct ipipe_percpu_domain_data *p = ipipe_cpudom_ptr(ipd);
-	int l0b = irq / BITS_PER_LONG;
 
 	IPIPE_WARN_ONCE(!irqs_disabled_hw());
 	
 	if (likely(!test_bit(IPIPE_LOCK_FLAG, &ipd->irqs[irq].control))) {
-		set_bit(irq, p->irqpend_lomap);
-		set_bit(l0b, &p->irqpend_himap);
+		__ipipe_log_irq(ipd, p, irq);
+		__ipipe_latency_log(ipd, p, irq);
 	} else
 		set_bit(irq, p->irqheld_map);
 
@@ -741,7 +976,8 @@ void __ipipe_unlock_irq(struct ipipe_domain *ipd, unsigned irq)
 	}
 }
 
-static inline int __ipipe_next_irq(struct ipipe_percpu_domain_data *p)
+static inline int __ipipe_next_irq(struct ipipe_domain *ipd,
+				   struct ipipe_percpu_domain_data *p)
 {
 	unsigned long l0m, l1m;
 	int l0b, l1b;
@@ -923,10 +1159,11 @@ int ipipe_virtualize_irq(struct ipipe_domain *ipd,
 		    ~(IPIPE_HANDLE_MASK | IPIPE_STICKY_MASK |
 		      IPIPE_EXCLUSIVE_MASK | IPIPE_WIRED_MASK);
 
+		ipd->irqs[irq].control = modemask;
+		smp_wmb();
 		ipd->irqs[irq].handler = NULL;
 		ipd->irqs[irq].cookie = NULL;
 		ipd->irqs[irq].acknowledge = NULL;
-		ipd->irqs[irq].control = modemask;
 
 		if (irq < NR_IRQS && !ipipe_virtual_irq_p(irq)) {
 			desc = irq_to_desc(irq);
@@ -971,9 +1208,18 @@ int ipipe_virtualize_irq(struct ipipe_domain *ipd,
 		 */
 		acknowledge = ipipe_root_domain->irqs[irq].acknowledge;
 
-	ipd->irqs[irq].handler = handler;
+	/*
+	 * Publish the handler after its cookie and acknowledge
+	 * routine, and the control bits last, so that a CPU
+	 * dispatching this IRQ concurrently either runs the old
+	 * handler or a fully set up new one, without stopping the
+	 * other CPUs. Removal above clears the control bits first.
+	 */
 	ipd->irqs[irq].cookie = cookie;
 	ipd->irqs[irq].acknowledge = acknowledge;
+	smp_wmb();
+	ipd->irqs[irq].handler = handler;
+	smp_wmb();
 	ipd->irqs[irq].control = modemask;
 
 	desc = irq_to_desc(irq);
@@ -1016,6 +1262,11 @@ int ipipe_control_irq(struct ipipe_domain *ipd, unsigned int irq,
 	if (irq >= IPIPE_NR_IRQS)
 		return -EINVAL;
 
+	/*
+	 * The control word is updated non-atomically, and any CPU may
+	 * be locking or logging this IRQ (lazy affinity moves,
+	 * ipipe_trigger_irq()): hold them all.
+	 */
 	flags = ipipe_critical_enter(NULL);
 
 	if (ipd->irqs[irq].control & IPIPE_SYSTEM_MASK) {
@@ -1170,6 +1421,7 @@ void __ipipe_dispatch_wired_nocheck(struct ipipe_domain *head, unsigned irq) /*
 
 	p->irqall[irq]++;
 	__set_bit(IPIPE_STALL_FLAG, &p->status);
+	__ipipe_latency_wired();
 	barrier();
 	head->irqs[irq].handler(irq, head->irqs[irq].cookie); /* Call the ISR. */
 	__ipipe_run_irqtail(irq);
@@ -1233,20 +1485,245 @@ void __ipipe_preempt_schedule_irq(void)
 
 #endif	/* !CONFIG_PREEMPT */
 
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+
+/* Root replay budget per sync (0: unbounded). */
+static unsigned long __ipipe_root_budget_ns = CONFIG_IPIPE_ROOT_BUDGET;
+static unsigned long long __ipipe_root_budget; /* TSC ticks */
+
+/*
+ * Guarantees the replay of the IRQs a root sync left behind, instead
+ * of waiting for the next unrelated interrupt.
+ */
+static DEFINE_PER_CPU(struct hrtimer, __ipipe_root_replay_timer);
+static int __ipipe_root_replay_ready;
+
+static unsigned long long __ipipe_ns2tsc(unsigned long ns)
+{
+	return div64_u64((unsigned long long)ns * 1000000ULL,
+			 ipipe_tsc2ns(1000000ULL));
+}
+
+/*
+ * Must be called hw IRQs off, before the root stage picks its next
+ * IRQ. The budget starts running with the first IRQ, which is always
+ * played so that every sync makes progress.
+ */
+static inline int __ipipe_root_budget_spent(unsigned long long *deadline)
+{
+	unsigned long long now, budget = __ipipe_root_budget;
+
+	if (budget == 0)
+		return 0;
+
+	ipipe_read_tsc(now);
+
+	if (*deadline == 0) {
+		*deadline = now + budget;
+		return 0;
+	}
+
+	return (long long)(now - *deadline) >= 0;
+}
+
+/*
+ * Put the IRQs held back by coalescing back into the log of @p, so
+ * that they get played if their interval has elapsed. Must be called
+ * hw IRQs off, on the CPU owning @p.
+ */
+static void __ipipe_root_undefer(struct ipipe_domain *ipd,
+				 struct ipipe_percpu_domain_data *p)
+{
+	unsigned long m;
+	unsigned int irq;
+	int n;
+
+	if (likely(p->irqdefer == 0))
+		return;
+
+	for (n = 0; n < IPIPE_IRQ_LOMAPSZ; n++) {
+		m = p->irqdefer_map[n];
+		p->irqdefer_map[n] = 0;
+		while (m) {
+			irq = n * BITS_PER_LONG + __ffs(m);
+			m &= m - 1;
+			if (test_bit(IPIPE_LOCK_FLAG, &ipd->irqs[irq].control))
+				set_bit(irq, p->irqheld_map);
+			else
+				__ipipe_log_irq(ipd, p, irq);
+		}
+	}
+
+	p->irqdefer = 0;
+	p->irqdefer_due = 0;
+}
+
+static enum hrtimer_restart __ipipe_root_replay_fn(struct hrtimer *timer)
+{
+	unsigned long flags;
+
+	/*
+	 * The root stage is stalled while we run; whatever we log
+	 * here is played by the sync which called us, or when the
+	 * stage is unstalled next.
+	 */
+	local_irq_save_hw(flags);
+	__ipipe_root_undefer(ipipe_root_domain, ipipe_root_cpudom_ptr());
+	local_irq_restore_hw(flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Must be called hw IRQs off, at the end of a root sync. When the
+ * budget was spent, the rest of the log is played one budget later,
+ * so that the interrupted context runs at least as long as the
+ * replay did. IRQs held back by coalescing are logged again when the
+ * first of them is due.
+ */
+static void __ipipe_root_replay_arm(struct ipipe_percpu_domain_data *p)
+{
+	unsigned long long now, delay;
+	struct hrtimer *timer;
+	ktime_t expires;
+
+	if (__ipipe_logged_p(p))
+		delay = __ipipe_root_budget;
+	else if (p->irqdefer) {
+		ipipe_read_tsc(now);
+		delay = (long long)(p->irqdefer_due - now) > 0 ?
+			p->irqdefer_due - now : 0;
+	} else
+		return;
+
+	timer = &per_cpu(__ipipe_root_replay_timer, ipipe_processor_id());
+	expires = ktime_add_ns(ktime_get(), ipipe_tsc2ns(delay));
+
+	if (hrtimer_is_queued(timer) &&
+	    hrtimer_get_expires_tv64(timer) <= expires.tv64)
+		return;
+
+	/* No wakeup: we may run over any root context here. */
+	__hrtimer_start_range_ns(timer, expires, 0,
+				 HRTIMER_MODE_ABS_PINNED, 0);
+}
+
+/*
+ * Must be called hw IRQs off, once the root stage picked @irq from
+ * its log. An IRQ bearing a coalescing hint is played at most once
+ * per hinted interval on each CPU: when its last replay is too
+ * recent, it is held back in p->irqdefer_map, where further
+ * occurrences merge into it, until a later sync finds the interval
+ * elapsed. IRQs arriving at a lower rate are not delayed at all.
+ */
+static inline int __ipipe_root_coalesce(struct ipipe_domain *ipd,
+					struct ipipe_percpu_domain_data *p,
+					unsigned int irq)
+{
+	unsigned long long now, due, hint = ipd->irqs[irq].coalesce;
+
+	if (likely(hint == 0) || unlikely(!__ipipe_root_replay_ready))
+		return 0;
+
+	ipipe_read_tsc(now);
+
+	if (now - p->irqreplay[irq] >= hint) {
+		p->irqreplay[irq] = now;
+		return 0;
+	}
+
+	if (!__test_and_set_bit(irq, p->irqdefer_map))
+		p->irqdefer++;
+
+	due = p->irqreplay[irq] + hint;
+	if (p->irqdefer_due == 0 || (long long)(due - p->irqdefer_due) < 0)
+		p->irqdefer_due = due;
+
+	return 1;
+}
+
+/*
+ * ipipe_set_irq_coalescing() -- Hint that the root domain may play
+ * @irq at most once every @ns nanoseconds on each CPU, merging the
+ * occurrences in between; zero clears the hint. Held back IRQs are
+ * delayed by up to the interval, so the latter is capped to
+ * IPIPE_COALESCE_MAX_NS.
+ */
+int ipipe_set_irq_coalescing(struct ipipe_domain *ipd,
+			     unsigned int irq,
+			     unsigned long ns)
+{
+	if (irq >= IPIPE_NR_IRQS || ns > IPIPE_COALESCE_MAX_NS)
+		return -EINVAL;
+
+	if (ipd != ipipe_root_domain)
+		return -EINVAL;
+
+	ipd->irqs[irq].coalesce = __ipipe_ns2tsc(ns);
+
+	return 0;
+}
+
+static void __init __ipipe_init_root_batch(void)
+{
+	struct hrtimer *timer;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		timer = &per_cpu(__ipipe_root_replay_timer, cpu);
+		hrtimer_init(timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED);
+		timer->function = __ipipe_root_replay_fn;
+	}
+
+	/* The TSC frequency is known by now. */
+	__ipipe_root_budget = __ipipe_ns2tsc(__ipipe_root_budget_ns);
+	smp_wmb();
+	__ipipe_root_replay_ready = 1;
+}
+
+#else /* !CONFIG_IPIPE_ROOT_BATCH */
+
+static inline int __ipipe_root_budget_spent(unsigned long long *deadline)
+{
+	return 0;
+}
+
+static inline void __ipipe_root_undefer(struct ipipe_domain *ipd,
+					struct ipipe_percpu_domain_data *p)
+{
+}
+
+static inline int __ipipe_root_coalesce(struct ipipe_domain *ipd,
+					struct ipipe_percpu_domain_data *p,
+					unsigned int irq)
+{
+	return 0;
+}
+
+static inline void __ipipe_root_replay_arm(struct ipipe_percpu_domain_data *p)
+{
+}
+
+#endif /* !CONFIG_IPIPE_ROOT_BATCH */
+
 /*
  * __ipipe_sync_stage() -- Flush the pending IRQs for the current
  * domain (and processor). This routine flushes the interrupt log
  * (see "Optimistic interrupt protection" from D. Stodolsky et al. for
  * more on the deferred interrupt scheme). Every interrupt that
- * occurred while the pipeline was stalled gets played. WARNING:
- * callers on SMP boxen should always check for CPU migration on
- * return of this routine.
+ * occurred while the pipeline was stalled gets played, unless the
+ * root stage runs out of its replay budget or holds back coalesced
+ * IRQs (CONFIG_IPIPE_ROOT_BATCH), in which case a per-CPU timer
+ * brings the rest back.
+ * WARNING: callers on SMP boxen should always check for CPU
+ * migration on return of this routine.
  *
  * This routine must be called with hw interrupts off.
  */
 void __ipipe_sync_stage(void)
 {
 	struct ipipe_percpu_domain_data *p;
+	unsigned long long deadline = 0;
 	struct ipipe_domain *ipd;
 	int irq;
 
@@ -1256,13 +1733,26 @@ void __ipipe_sync_stage(void)
 	__set_bit(IPIPE_STALL_FLAG, &p->status);
 	smp_wmb();
 
-	if (ipd == ipipe_root_domain)
+	if (ipd == ipipe_root_domain) {
 		trace_hardirqs_off();
+		__ipipe_latency_root_sync();
+		__ipipe_root_undefer(ipd, p);
+	}
 
 	for (;;) {
-		irq = __ipipe_next_irq(p);
+		if (ipd == ipipe_root_domain &&
+		    __ipipe_root_budget_spent(&deadline))
+			break;
+
+		irq = __ipipe_next_irq(ipd, p);
 		if (irq < 0)
 			break;
+
+		if (ipd == ipipe_root_domain &&
+		    __ipipe_root_coalesce(ipd, p, irq))
+			continue;
+
+		__ipipe_latency_replay(ipd, p, irq);
 		/*
 		 * Make sure the compiler does not reorder wrongly, so
 		 * that all updates to maps are done before the
@@ -1297,8 +1787,10 @@ void __ipipe_sync_stage(void)
 		p = ipipe_cpudom_ptr(__ipipe_current_domain);
 	}
 
-	if (ipd == ipipe_root_domain)
+	if (ipd == ipipe_root_domain) {
+		__ipipe_root_replay_arm(p);
 		trace_hardirqs_on();
+	}
 
 	__clear_bit(IPIPE_STALL_FLAG, &p->status);
 }
@@ -1319,11 +1811,16 @@ int ipipe_register_domain(struct ipipe_domain *ipd,
 		return -EPERM;
 	}
 
-	flags = ipipe_critical_enter(NULL);
+	/*
+	 * Slot allocation and list updates only race with other
+	 * control-plane operations, the pipelock is enough; the
+	 * dispatchers walk the list locklessly (see below).
+	 */
+	spin_lock_irqsave(&__ipipe_pipelock, flags);
 
 	if (attr->priority == IPIPE_HEAD_PRIORITY) {
 		if (test_bit(IPIPE_HEAD_SLOT, &__ipipe_domain_slot_map)) {
-			ipipe_critical_exit(flags);
+			spin_unlock_irqrestore(&__ipipe_pipelock, flags);
 			return -EAGAIN;	/* Cannot override current head. */
 		}
 		ipd->slot = IPIPE_HEAD_SLOT;
@@ -1339,7 +1836,7 @@ int ipipe_register_domain(struct ipipe_domain *ipd,
 		}
 	}
 
-	ipipe_critical_exit(flags);
+	spin_unlock_irqrestore(&__ipipe_pipelock, flags);
 
 	if (pos != &__ipipe_pipeline) {
 		if (ipd->slot < CONFIG_IPIPE_DOMAINS)
@@ -1377,7 +1874,12 @@ int ipipe_register_domain(struct ipipe_domain *ipd,
 	__ipipe_add_domain_proc(ipd);
 #endif /* CONFIG_PROC_FS */
 
-	flags = ipipe_critical_enter(NULL);
+	/*
+	 * Publish the fully initialized domain RCU-style: a CPU
+	 * walking the pipeline concurrently either skips it or sees
+	 * its final contents, so no CPU has to be stopped.
+	 */
+	spin_lock_irqsave(&__ipipe_pipelock, flags);
 
 	list_for_each(pos, &__ipipe_pipeline) {
 		_ipd = list_entry(pos, struct ipipe_domain, p_link);
@@ -1385,9 +1887,9 @@ int ipipe_register_domain(struct ipipe_domain *ipd,
 			break;
 	}
 
-	list_add_tail(&ipd->p_link, pos);
+	list_add_tail_rcu(&ipd->p_link, pos);
 
-	ipipe_critical_exit(flags);
+	spin_unlock_irqrestore(&__ipipe_pipelock, flags);
 
 	printk(KERN_INFO "I-pipe: Domain %s registered.\n", ipd->name);
 
@@ -1472,12 +1974,22 @@ int ipipe_unregister_domain(struct ipipe_domain *ipd)
 #endif /* CONFIG_PROC_FS */
 
 	/*
-	 * Simply remove the domain from the pipeline and we are almost done.
+	 * Unlink the domain, leaving both of its links intact for the
+	 * CPUs still walking past it in either direction (the tracer
+	 * walks backwards), then wait for them. Walkers run
+	 * with hw IRQs off, possibly over an idle root domain which
+	 * RCU would not wait for, so the grace period is a critical
+	 * section: every other CPU has left its walk once it takes
+	 * the sync IPI. Unregistration is the only pipeline update
+	 * which still stops the world.
 	 */
+	spin_lock_irqsave(&__ipipe_pipelock, flags);
+	__list_del(ipd->p_link.prev, ipd->p_link.next);
+	spin_unlock_irqrestore(&__ipipe_pipelock, flags);
 
 	flags = ipipe_critical_enter(NULL);
-	list_del_init(&ipd->p_link);
 	ipipe_critical_exit(flags);
+	INIT_LIST_HEAD(&ipd->p_link);
 
 	__ipipe_cleanup_domain(ipd);
 
@@ -1555,7 +2067,12 @@ ipipe_event_handler_t ipipe_catch_event(struct ipipe_domain *ipd,
 	if (event >= IPIPE_NR_EVENTS)
 		return NULL;
 
-	flags = ipipe_critical_enter(NULL);
+	/*
+	 * The handler is published atomically and dispatchers cope
+	 * with a monitor count briefly out of sync with it, so this
+	 * only has to serialize against other updaters.
+	 */
+	spin_lock_irqsave(&__ipipe_pipelock, flags);
 
 	if (!(old_handler = xchg(&ipd->evhand[event],handler)))	{
 		if (handler) {
@@ -1578,7 +2095,7 @@ ipipe_event_handler_t ipipe_catch_event(struct ipipe_domain *ipd,
 			ipd->evself |= (1LL << event);
 	}
 
-	ipipe_critical_exit(flags);
+	spin_unlock_irqrestore(&__ipipe_pipelock, flags);
 
 	if (!handler && ipipe_root_domain_p) {
 		/*
@@ -1676,12 +2193,17 @@ void __ipipe_do_critical_sync(unsigned irq, void *cookie)
 #endif	/* CONFIG_SMP */
 
 /*
- * ipipe_critical_enter() -- Grab the superlock excluding all CPUs but
- * the current one from a critical section. This lock is used when we
- * must enforce a global critical section for a single CPU in a
- * possibly SMP system whichever context the CPUs are running.
+ * ipipe_critical_enter_mask() -- Grab the superlock excluding the
+ * CPUs in @mask from a critical section, whichever context they are
+ * running. The other CPUs keep running, so this is only usable when
+ * the data being changed is not accessed locklessly from them, e.g.
+ * the per-CPU state of a tick device. IRQ affinity is not such a
+ * bound: x86 moves IRQs lazily and ipipe_trigger_irq() logs them on
+ * any CPU. A nested call widens the set of held CPUs if needed; its
+ * sync routine is ignored as for ipipe_critical_enter().
  */
-unsigned long ipipe_critical_enter(void (*syncfn)(void))
+unsigned long ipipe_critical_enter_mask(void (*syncfn)(void),
+					const struct cpumask *mask)
 {
 	unsigned long flags;
 
@@ -1690,9 +2212,12 @@ unsigned long ipipe_critical_enter(void (*syncfn)(void))
 #ifdef CONFIG_SMP
 	if (num_online_cpus() > 1) {
 		int cpu = ipipe_processor_id();
-		cpumask_t allbutself;
 		unsigned long loops;
 
+		/*
+		 * No cpumask on the stack: the target and scratch maps
+		 * are only touched while holding the superlock.
+		 */
 		if (!cpu_test_and_set(cpu, __ipipe_cpu_lock_map)) {
 			while (test_and_set_bit(0, &__ipipe_critical_lock)) {
 				int n = 0;
@@ -1713,18 +2238,22 @@ restart:
 
 			cpus_clear(__ipipe_cpu_pass_map);
 			cpu_set(cpu, __ipipe_cpu_pass_map);
+			cpumask_and(&__ipipe_cpu_target_map, mask,
+				    cpu_online_mask);
+			cpu_clear(cpu, __ipipe_cpu_target_map);
 
 			/*
-			 * Send the sync IPI to all processors but the current
-			 * one.
+			 * Send the sync IPI to the target processors
+			 * but the current one.
 			 */
-			cpus_andnot(allbutself, cpu_online_map,
-				    __ipipe_cpu_pass_map);
-			__ipipe_send_ipi(IPIPE_CRITICAL_IPI, allbutself);
+			if (!cpus_empty(__ipipe_cpu_target_map))
+				__ipipe_send_ipi(IPIPE_CRITICAL_IPI,
+						 __ipipe_cpu_target_map);
 
 			loops = IPIPE_CRITICAL_TIMEOUT;
 
-			while (!cpus_equal(__ipipe_cpu_sync_map, allbutself)) {
+			while (!cpus_equal(__ipipe_cpu_sync_map,
+					   __ipipe_cpu_target_map)) {
 				cpu_relax();
 
 				if (--loops == 0) {
@@ -1743,13 +2272,52 @@ restart:
 					 * prematurely. This usually resolves
 					 * the deadlock reason too.
 					 */
-					while (!cpus_equal(cpu_online_map,
+					cpus_or(__ipipe_cpu_scratch_map,
+						__ipipe_cpu_target_map,
+						cpumask_of_cpu(cpu));
+					while (!cpus_equal(__ipipe_cpu_scratch_map,
 							   __ipipe_cpu_pass_map))
 						cpu_relax();
 
 					goto restart;
 				}
 			}
+		} else {
+			/*
+			 * Nested section: hold the CPUs the outer one
+			 * left running. They block on the barrier we
+			 * already own. This round cannot be cancelled
+			 * without breaking the outer section, so a
+			 * late CPU is only reported.
+			 */
+			cpumask_and(&__ipipe_cpu_scratch_map, mask,
+				    cpu_online_mask);
+			cpu_clear(cpu, __ipipe_cpu_scratch_map);
+			cpus_andnot(__ipipe_cpu_scratch_map,
+				    __ipipe_cpu_scratch_map,
+				    __ipipe_cpu_target_map);
+			if (!cpus_empty(__ipipe_cpu_scratch_map)) {
+				cpus_or(__ipipe_cpu_target_map,
+					__ipipe_cpu_target_map,
+					__ipipe_cpu_scratch_map);
+				__ipipe_send_ipi(IPIPE_CRITICAL_IPI,
+						 __ipipe_cpu_scratch_map);
+				loops = IPIPE_CRITICAL_TIMEOUT;
+				while (!cpus_equal(__ipipe_cpu_sync_map,
+						   __ipipe_cpu_target_map)) {
+					cpu_relax();
+					if (--loops == 0) {
+						cpus_andnot(__ipipe_cpu_scratch_map,
+							    __ipipe_cpu_target_map,
+							    __ipipe_cpu_sync_map);
+						printk(KERN_WARNING
+						       "I-pipe: CPU%d: nested critical "
+						       "section still waiting for "
+						       "CPUs 0x%lx\n", cpu,
+						       cpus_addr(__ipipe_cpu_scratch_map)[0]);
+					}
+				}
+			}
 		}
 
 		atomic_inc(&__ipipe_critical_count);
@@ -1759,6 +2327,17 @@ restart:
 	return flags;
 }
 
+/*
+ * ipipe_critical_enter() -- Grab the superlock excluding all CPUs but
+ * the current one from a critical section. This lock is used when we
+ * must enforce a global critical section for a single CPU in a
+ * possibly SMP system whichever context the CPUs are running.
+ */
+unsigned long ipipe_critical_enter(void (*syncfn)(void))
+{
+	return ipipe_critical_enter_mask(syncfn, cpu_online_mask);
+}
+
 /* ipipe_critical_exit() -- Release the superlock. */
 
 void ipipe_critical_exit(unsigned long flags)
@@ -1886,6 +2465,56 @@ static int __ipipe_version_info_proc(char *page,
 	return len;
 }
 
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+
+static int __ipipe_root_budget_read(char *page, char **start, off_t off,
+				    int count, int *eof, void *data)
+{
+	int len = sprintf(page, "%lu\n", __ipipe_root_budget_ns);
+
+	len -= off;
+
+	if (len <= off + count)
+		*eof = 1;
+
+	*start = page + off;
+
+	if (len > count)
+		len = count;
+
+	if (len < 0)
+		len = 0;
+
+	return len;
+}
+
+static int __ipipe_root_budget_write(struct file *file,
+				     const char __user *buffer,
+				     unsigned long count, void *data)
+{
+	char *end, buf[16];
+	unsigned long ns;
+	int n;
+
+	n = (count > sizeof(buf) - 1) ? sizeof(buf) - 1 : count;
+
+	if (copy_from_user(buf, buffer, n))
+		return -EFAULT;
+
+	buf[n] = '\0';
+	ns = simple_strtoul(buf, &end, 0);
+
+	if (((*end != '\0') && !isspace(*end)) || ns > NSEC_PER_SEC)
+		return -EINVAL;
+
+	__ipipe_root_budget_ns = ns;
+	__ipipe_root_budget = __ipipe_ns2tsc(ns);
+
+	return count;
+}
+
+#endif /* CONFIG_IPIPE_ROOT_BATCH */
+
 static int __ipipe_common_info_show(struct seq_file *p, void *data)
 {
 	struct ipipe_domain *ipd = (struct ipipe_domain *)p->private;
@@ -2000,6 +2629,81 @@ static struct file_operations __ipipe_info_proc_ops = {
 	.release	= single_release,
 };
 
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+
+static const char *__ipipe_latency_names[IPIPE_LAT_NR] = {
+	[IPIPE_LAT_IRQ2HEAD] = "irq2head",
+	[IPIPE_LAT_ROOTREPLAY] = "rootreplay",
+	[IPIPE_LAT_ROOTSTALL] = "rootstall",
+};
+
+/*
+ * One table per CPU, one line per non-empty log2 bucket. Each line
+ * counts the delays below its bound and at least half of it; the
+ * last bucket collects everything longer.
+ */
+static int __ipipe_latency_show(struct seq_file *p, void *data)
+{
+	struct ipipe_latency_data *l;
+	int cpu, b, n;
+
+	for_each_online_cpu(cpu) {
+		l = &per_cpu(ipipe_latency_data, cpu);
+
+		seq_printf(p, "CPU%-3d      < ns", cpu);
+		for (n = 0; n < IPIPE_LAT_NR; n++)
+			seq_printf(p, " %11s", __ipipe_latency_names[n]);
+		seq_printf(p, "\n");
+
+		for (b = 0; b < IPIPE_LAT_BUCKETS; b++) {
+			for (n = 0; n < IPIPE_LAT_NR; n++)
+				if (l->hist[n][b])
+					break;
+			if (n == IPIPE_LAT_NR)
+				continue;
+
+			if (b == IPIPE_LAT_BUCKETS - 1)
+				seq_printf(p, "%16s", "inf");
+			else
+				seq_printf(p, "%16llu", ipipe_tsc2ns(1ULL << b));
+			for (n = 0; n < IPIPE_LAT_NR; n++)
+				seq_printf(p, " %11lu", l->hist[n][b]);
+			seq_printf(p, "\n");
+		}
+	}
+
+	return 0;
+}
+
+static int __ipipe_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, __ipipe_latency_show, NULL);
+}
+
+/* Any write clears the histograms. */
+static ssize_t __ipipe_latency_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		memset(per_cpu(ipipe_latency_data, cpu).hist, 0,
+		       sizeof(per_cpu(ipipe_latency_data, cpu).hist));
+
+	return count;
+}
+
+static struct file_operations __ipipe_latency_proc_ops = {
+	.owner		= THIS_MODULE,
+	.open		= __ipipe_latency_open,
+	.read		= seq_read,
+	.write		= __ipipe_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#endif /* CONFIG_IPIPE_LATENCY_HIST */
+
 void __ipipe_add_domain_proc(struct ipipe_domain *ipd)
 {
 	struct proc_dir_entry *e = create_proc_entry(ipd->name, 0444, ipipe_proc_root);
@@ -2019,6 +2723,28 @@ void __init ipipe_init_proc(void)
 	ipipe_proc_root = create_proc_entry("ipipe",S_IFDIR, 0);
 	create_proc_read_entry("version",0444,ipipe_proc_root,&__ipipe_version_info_proc,NULL);
 	__ipipe_add_domain_proc(ipipe_root_domain);
+#ifdef CONFIG_IPIPE_LATENCY_HIST
+	{
+		struct proc_dir_entry *e;
+
+		e = create_proc_entry("latency", 0644, ipipe_proc_root);
+		if (e)
+			e->proc_fops = &__ipipe_latency_proc_ops;
+	}
+#endif
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+	{
+		struct proc_dir_entry *e;
+
+		__ipipe_init_root_batch();
+
+		e = create_proc_entry("root_budget", 0644, ipipe_proc_root);
+		if (e) {
+			e->read_proc = __ipipe_root_budget_read;
+			e->write_proc = __ipipe_root_budget_write;
+		}
+	}
+#endif
 
 	__ipipe_init_tracer();
 }
@@ -2186,6 +2912,12 @@ EXPORT_SYMBOL(ipipe_set_irq_affinity);
 EXPORT_SYMBOL(ipipe_send_ipi);
 EXPORT_SYMBOL(__ipipe_pend_irq);
 EXPORT_SYMBOL(__ipipe_set_irq_pending);
+#ifdef CONFIG_IPIPE_IRQLOG
+EXPORT_SYMBOL(ipipe_set_irq_priority);
+#endif
+#ifdef CONFIG_IPIPE_ROOT_BATCH
+EXPORT_SYMBOL(ipipe_set_irq_coalescing);
+#endif
 EXPORT_SYMBOL(__ipipe_event_monitors);
 #if defined(CONFIG_IPIPE_DEBUG_INTERNAL) && defined(CONFIG_SMP)
 EXPORT_SYMBOL(__ipipe_check_percpu_access);
@@ -2196,6 +2928,7 @@ EXPORT_SYMBOL(ipipe_release_tickdev);
 #endif
 
 EXPORT_SYMBOL(ipipe_critical_enter);
+EXPORT_SYMBOL(ipipe_critical_enter_mask);
 EXPORT_SYMBOL(ipipe_critical_exit);
 EXPORT_SYMBOL(ipipe_trigger_irq);
 EXPORT_SYMBOL(ipipe_get_sysinfo);
@@ -0,0 +1,259 @@
+/* -*- linux-c -*-
+ * kernel/ipipe/irqbench.c
+ *
+ * Interrupt log micro-benchmark: measures how long it takes for a
+ * stage to reach its handlers once a burst of IRQs has been logged
+ * while it was stalled, for the head domain and the root domain.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, Inc., 675 Mass Ave, Cambridge MA 02139,
+ * USA; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/moduleparam.h>
+#include <linux/preempt.h>
+#include <linux/math64.h>
+#include <linux/ipipe.h>
+
+#ifdef CONFIG_IPIPE_IRQLOG
+#define IRQBENCH_DESIGN		"irqlog"
+#else
+#define IRQBENCH_DESIGN		"bitmap"
+#endif
+
+#define IRQBENCH_MAX_IRQS	(IPIPE_NR_VIRQS / 2)
+
+static unsigned int nr_irqs = 16;
+static unsigned int loops = 10000;
+
+module_param(nr_irqs, uint, 0444);
+MODULE_PARM_DESC(nr_irqs, "Number of IRQs logged per burst");
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Number of bursts per stage");
+
+struct irqbench_stat {
+	unsigned long long min, max, sum;
+	unsigned int count;	/* bursts recorded */
+};
+
+struct irqbench_run {
+	const char *stage;
+	unsigned int virqs[IRQBENCH_MAX_IRQS];
+	unsigned int nr;
+	struct irqbench_stat urgent;	/* trigger -> urgent IRQ handler */
+	struct irqbench_stat first;	/* trigger -> first handler */
+	struct irqbench_stat replay;	/* trigger -> last handler, per IRQ */
+};
+
+static struct ipipe_domain irqbench_domain;
+static struct irqbench_run head_run = { .stage = "head" };
+static struct irqbench_run root_run = { .stage = "root" };
+
+/* Handler side of the current burst, only touched on the bench CPU. */
+static unsigned int burst_urgent;
+static unsigned int burst_seen;
+static unsigned long long burst_first, burst_last, burst_urgent_tsc;
+
+static void irqbench_handler(unsigned int irq, void *cookie)
+{
+	unsigned long long now;
+
+	ipipe_read_tsc(now);
+
+	if (burst_seen++ == 0)
+		burst_first = now;
+	if (irq == burst_urgent)
+		burst_urgent_tsc = now;
+	burst_last = now;
+}
+
+static void irqbench_stat_add(struct irqbench_stat *s, unsigned long long v)
+{
+	if (v < s->min)
+		s->min = v;
+	if (v > s->max)
+		s->max = v;
+	s->sum += v;
+	s->count++;
+}
+
+/*
+ * Log a burst on the stalled stage, the urgent IRQ last so that a
+ * plain FIFO would play it after every other one, then unstall and
+ * time the replay.
+ */
+static void irqbench_burst(struct irqbench_run *run)
+{
+	unsigned long long t0;
+	unsigned long flags = 0;
+	int n;
+
+	burst_seen = 0;
+	burst_urgent = run->virqs[0];
+
+	if (run == &head_run)
+		ipipe_stall_pipeline_from(&irqbench_domain);
+	else
+		local_irq_save(flags);
+
+	for (n = run->nr - 1; n >= 0; n--)
+		ipipe_trigger_irq(run->virqs[n]);
+
+	ipipe_read_tsc(t0);
+
+	if (run == &head_run)
+		ipipe_unstall_pipeline_from(&irqbench_domain);
+	else
+		local_irq_restore(flags);
+
+	if (burst_seen != run->nr)
+		return;
+
+	irqbench_stat_add(&run->urgent, burst_urgent_tsc - t0);
+	irqbench_stat_add(&run->first, burst_first - t0);
+	irqbench_stat_add(&run->replay, div_u64(burst_last - t0, run->nr));
+}
+
+static void irqbench_report(struct irqbench_run *run, const char *what,
+			    struct irqbench_stat *s)
+{
+	if (s->count == 0) {
+		printk(KERN_INFO "I-pipe irqbench: %s/%s %-6s no complete "
+		       "burst\n", IRQBENCH_DESIGN, run->stage, what);
+		return;
+	}
+
+	printk(KERN_INFO "I-pipe irqbench: %s/%s %-6s min %llu ns, "
+	       "avg %llu ns, max %llu ns (%u bursts)\n",
+	       IRQBENCH_DESIGN, run->stage, what,
+	       (unsigned long long)ipipe_tsc2ns(s->min),
+	       (unsigned long long)ipipe_tsc2ns(div_u64(s->sum, s->count)),
+	       (unsigned long long)ipipe_tsc2ns(s->max), s->count);
+}
+
+static void irqbench_run(struct irqbench_run *run)
+{
+	unsigned int n;
+
+	run->urgent.min = run->first.min = run->replay.min = ULLONG_MAX;
+
+	for (n = 0; n < loops; n++) {
+		preempt_disable();
+		irqbench_burst(run);
+		preempt_enable();
+	}
+
+	irqbench_report(run, "urgent", &run->urgent);
+	irqbench_report(run, "first", &run->first);
+	irqbench_report(run, "replay", &run->replay);
+}
+
+static void irqbench_free(struct irqbench_run *run, struct ipipe_domain *ipd)
+{
+	while (run->nr > 0) {
+		run->nr--;
+		ipipe_virtualize_irq(ipd, run->virqs[run->nr],
+				     NULL, NULL, NULL, IPIPE_PASS_MASK);
+		ipipe_free_virq(run->virqs[run->nr]);
+	}
+}
+
+static int irqbench_setup(struct irqbench_run *run, struct ipipe_domain *ipd)
+{
+	unsigned int virq;
+	int ret;
+
+	while (run->nr < nr_irqs) {
+		virq = ipipe_alloc_virq();
+		if (virq == 0)
+			return -EBUSY;
+
+		ret = ipipe_virtualize_irq(ipd, virq, &irqbench_handler, NULL,
+					   NULL, IPIPE_HANDLE_MASK);
+		if (ret) {
+			ipipe_free_virq(virq);
+			return ret;
+		}
+		run->virqs[run->nr] = virq;
+#ifdef CONFIG_IPIPE_IRQLOG
+		/*
+		 * Make the first IRQ the most urgent one and spread
+		 * the others over the lower classes. The bitmap log
+		 * plays IRQs by number instead.
+		 */
+		if (ipd != ipipe_root_domain)
+			ipipe_set_irq_priority(ipd, virq, run->nr ?
+					       run->nr % (IPIPE_IRQ_NRPRIO - 1) :
+					       IPIPE_IRQ_NRPRIO - 1);
+#endif
+		run->nr++;
+	}
+
+	return 0;
+}
+
+static int __init irqbench_init(void)
+{
+	struct ipipe_domain_attr attr;
+	int ret;
+
+	if (nr_irqs == 0 || nr_irqs > IRQBENCH_MAX_IRQS || loops == 0)
+		return -EINVAL;
+
+	ipipe_init_attr(&attr);
+	attr.name = "irqbench";
+	attr.domid = 0x49524242;
+	attr.priority = IPIPE_HEAD_PRIORITY;
+
+	ret = ipipe_register_domain(&irqbench_domain, &attr);
+	if (ret == -EAGAIN) {
+		/* Some other domain heads the pipeline, sit below it. */
+		attr.priority = IPIPE_ROOT_PRIO + 1;
+		ret = ipipe_register_domain(&irqbench_domain, &attr);
+	}
+	if (ret)
+		return ret;
+
+	ret = irqbench_setup(&head_run, &irqbench_domain);
+	if (ret == 0)
+		ret = irqbench_setup(&root_run, ipipe_root_domain);
+	if (ret)
+		goto out;
+
+	printk(KERN_INFO "I-pipe irqbench: %s log, %u IRQs per burst, "
+	       "%u bursts per stage\n", IRQBENCH_DESIGN, nr_irqs, loops);
+
+	irqbench_run(&head_run);
+	irqbench_run(&root_run);
+out:
+	irqbench_free(&root_run, ipipe_root_domain);
+	irqbench_free(&head_run, &irqbench_domain);
+	ipipe_unregister_domain(&irqbench_domain);
+
+	return ret;
+}
+
+/* Everything is released once the report is out. */
+static void __exit irqbench_exit(void)
+{
+}
+
+module_init(irqbench_init);
+module_exit(irqbench_exit);
+
+MODULE_DESCRIPTION("I-pipe interrupt log latency benchmark");
+MODULE_LICENSE("GPL");
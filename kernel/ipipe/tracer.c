@@ -32,7 +32,12 @@
 #include <linux/vermagic.h>
 #include <linux/sched.h>
 #include <linux/ipipe.h>
+#include <linux/ipipe_trace.h>
 #include <linux/ftrace.h>
+#include <linux/mm.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/delay.h>
 #include <asm/uaccess.h>
 
 #define IPIPE_TRACE_PATHS           4 /* <!> Do not lower below 3 */
@@ -124,6 +129,32 @@ static unsigned long trace_overhead;
 static unsigned long trigger_begin;
 static unsigned long trigger_end;
 
+#ifdef CONFIG_IPIPE_TRACE_STREAM
+#define IPIPE_STREAM_POINTS         (1 << CONFIG_IPIPE_TRACE_STREAM_SHIFT)
+#define IPIPE_STREAM_POLL_MS        10
+#define IPIPE_STREAM_RECSZ          sizeof(struct ipipe_trace_record)
+
+/*
+ * Per-CPU stream ring. The producer is __ipipe_trace() on the owner
+ * CPU (hw IRQs off, path NMI-locked), the consumer the reader of the
+ * cpuN file, serialized by @lock since the file may be shared, so
+ * head and tail are each written by one side only. The producer never
+ * overwrites unread records: when the ring is full the new point is
+ * dropped and accounted in @lost.
+ */
+struct ipipe_trace_stream {
+	unsigned long head; /* next record to fill, producer side */
+	unsigned long lost; /* dropped since the last stored record */
+	unsigned long tail ____cacheline_aligned_in_smp; /* consumer side */
+	unsigned long busy; /* bit 0: file opened */
+	struct mutex lock; /* serializes read() and splice_read() */
+	struct ipipe_trace_record *rec;
+};
+
+static DEFINE_PER_CPU(struct ipipe_trace_stream, trace_stream);
+static int stream_enable;
+#endif /* CONFIG_IPIPE_TRACE_STREAM */
+
 static DEFINE_MUTEX(out_mutex);
 static struct ipipe_trace_path *print_path;
 #ifdef CONFIG_IPIPE_TRACE_PANIC
@@ -160,6 +191,41 @@ __ipipe_store_domain_states(struct ipipe_trace_point *point)
 	}
 }
 
+#ifdef CONFIG_IPIPE_TRACE_STREAM
+static notrace void
+__ipipe_stream_point(int cpu, struct ipipe_trace_point *point)
+{
+	struct ipipe_trace_stream *ts = &per_cpu(trace_stream, cpu);
+	struct ipipe_trace_record *rec;
+	unsigned long head = ts->head;
+
+	if (!stream_enable || !ts->rec)
+		return;
+
+	if (head - ACCESS_ONCE(ts->tail) >= IPIPE_STREAM_POINTS) {
+		ts->lost++;
+		return;
+	}
+
+	rec = &ts->rec[head & (IPIPE_STREAM_POINTS - 1)];
+	rec->timestamp = point->timestamp;
+	rec->eip = point->eip;
+	rec->parent_eip = point->parent_eip;
+	rec->v = point->v;
+	rec->lost = ts->lost;
+	rec->type = point->type;
+	rec->flags = point->flags;
+	ts->lost = 0;
+
+	/* publish the record before the new head */
+	smp_wmb();
+	ts->head = head + 1;
+}
+#else /* !CONFIG_IPIPE_TRACE_STREAM */
+static inline notrace void
+__ipipe_stream_point(int cpu, struct ipipe_trace_point *point) { }
+#endif /* CONFIG_IPIPE_TRACE_STREAM */
+
 static notrace int __ipipe_get_free_trace_path(int old, int cpu)
 {
 	int new_active = old;
@@ -327,6 +393,8 @@ __ipipe_trace(enum ipipe_trace_type type, unsigned long eip,
 
 	__ipipe_store_domain_states(point);
 
+	__ipipe_stream_point(cpu, point);
+
 	/* forward to next point buffer */
 	next_pos = WRAP_POINT_NO(pos+1);
 	tp->trace_pos = next_pos;
@@ -1193,6 +1261,220 @@ struct file_operations __ipipe_frozen_prtrace_fops = {
 	.release    = seq_release,
 };
 
+#ifdef CONFIG_IPIPE_TRACE_STREAM
+/*
+ * number of records readable in one go from @tail, which is at or
+ * past the consumer tail, returns its index
+ */
+static unsigned long
+__ipipe_stream_peek(struct ipipe_trace_stream *ts, unsigned long tail,
+		    unsigned long *idx)
+{
+	unsigned long head;
+
+	head = ACCESS_ONCE(ts->head);
+	/* read the records only after the head which published them */
+	smp_rmb();
+
+	*idx = tail & (IPIPE_STREAM_POINTS - 1);
+
+	return min(head - tail, IPIPE_STREAM_POINTS - *idx);
+}
+
+static void __ipipe_stream_consume(struct ipipe_trace_stream *ts,
+				   unsigned long n)
+{
+	/* finish reading the records before releasing their slots */
+	smp_mb();
+	ts->tail += n;
+}
+
+/*
+ * The producer may run over any domain, so it cannot wake us up:
+ * poll the ring instead.
+ */
+static int __ipipe_stream_wait(struct ipipe_trace_stream *ts, int nonblock)
+{
+	unsigned long idx;
+
+	while (!__ipipe_stream_peek(ts, ts->tail, &idx)) {
+		if (nonblock)
+			return -EAGAIN;
+		msleep_interruptible(IPIPE_STREAM_POLL_MS);
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+	}
+
+	return 0;
+}
+
+static int __ipipe_stream_open(struct inode *inode, struct file *file)
+{
+	struct ipipe_trace_stream *ts;
+
+	ts = &per_cpu(trace_stream, (long)PDE(inode)->data);
+	if (!ts->rec)
+		return -ENOMEM;
+
+	if (test_and_set_bit(0, &ts->busy))
+		return -EBUSY;
+
+	file->private_data = ts;
+
+	return nonseekable_open(inode, file);
+}
+
+static int __ipipe_stream_release(struct inode *inode, struct file *file)
+{
+	struct ipipe_trace_stream *ts = file->private_data;
+
+	smp_mb__before_clear_bit();
+	clear_bit(0, &ts->busy);
+
+	return 0;
+}
+
+static ssize_t __ipipe_stream_read(struct file *file, char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct ipipe_trace_stream *ts = file->private_data;
+	unsigned long idx, n;
+	size_t done = 0;
+	int ret;
+
+	if (count < IPIPE_STREAM_RECSZ)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&ts->lock))
+		return -ERESTARTSYS;
+
+	ret = __ipipe_stream_wait(ts, file->f_flags & O_NONBLOCK);
+	if (ret)
+		goto out;
+
+	while (count - done >= IPIPE_STREAM_RECSZ &&
+	       (n = __ipipe_stream_peek(ts, ts->tail, &idx)) > 0) {
+		n = min_t(unsigned long, n, (count - done) / IPIPE_STREAM_RECSZ);
+		if (copy_to_user(ubuf + done, &ts->rec[idx],
+				 n * IPIPE_STREAM_RECSZ)) {
+			if (!done)
+				ret = -EFAULT;
+			break;
+		}
+		__ipipe_stream_consume(ts, n);
+		done += n * IPIPE_STREAM_RECSZ;
+	}
+out:
+	mutex_unlock(&ts->lock);
+
+	if (ret)
+		return ret;
+
+	return done;
+}
+
+static void __ipipe_stream_spd_release(struct splice_pipe_desc *spd,
+				       unsigned int i)
+{
+	__free_page(spd->pages[i]);
+}
+
+static const struct pipe_buf_operations __ipipe_stream_buf_ops = {
+	.can_merge  = 0,
+	.map        = generic_pipe_buf_map,
+	.unmap      = generic_pipe_buf_unmap,
+	.confirm    = generic_pipe_buf_confirm,
+	.release    = generic_pipe_buf_release,
+	.steal      = generic_pipe_buf_steal,
+	.get        = generic_pipe_buf_get,
+};
+
+/*
+ * Fill fresh pages with whole records and hand them over to the pipe.
+ * The records are only released once splice_to_pipe() tells how many
+ * bytes it actually moved.
+ */
+static ssize_t __ipipe_stream_splice_read(struct file *file, loff_t *ppos,
+					  struct pipe_inode_info *pipe,
+					  size_t len, unsigned int flags)
+{
+	struct ipipe_trace_stream *ts = file->private_data;
+	struct page *pages_def[PIPE_DEF_BUFFERS];
+	struct partial_page partial_def[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages       = pages_def,
+		.partial     = partial_def,
+		.nr_pages    = 0,
+		.flags       = flags,
+		.ops         = &__ipipe_stream_buf_ops,
+		.spd_release = __ipipe_stream_spd_release,
+	};
+	unsigned long idx, n, fill, max, tail;
+	unsigned int i;
+	size_t rem;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&ts->lock))
+		return -ERESTARTSYS;
+
+	ret = __ipipe_stream_wait(ts, (file->f_flags & O_NONBLOCK) ||
+				  (flags & SPLICE_F_NONBLOCK));
+	if (ret)
+		goto out;
+
+	ret = -ENOMEM;
+	if (splice_grow_spd(pipe, &spd))
+		goto out;
+
+	tail = ts->tail;
+	for (i = 0, rem = len; i < pipe->buffers && rem >= IPIPE_STREAM_RECSZ;
+	     i++) {
+		if (!__ipipe_stream_peek(ts, tail, &idx))
+			break;
+
+		spd.pages[i] = alloc_page(GFP_KERNEL);
+		if (!spd.pages[i])
+			break;
+
+		max = min_t(size_t, rem, PAGE_SIZE) / IPIPE_STREAM_RECSZ;
+		for (fill = 0; fill < max; fill += n) {
+			n = __ipipe_stream_peek(ts, tail, &idx);
+			if (!n)
+				break;
+			n = min(n, max - fill);
+			memcpy(page_address(spd.pages[i]) +
+			       fill * IPIPE_STREAM_RECSZ,
+			       &ts->rec[idx], n * IPIPE_STREAM_RECSZ);
+			tail += n;
+		}
+
+		spd.partial[i].offset = 0;
+		spd.partial[i].len = fill * IPIPE_STREAM_RECSZ;
+		rem -= spd.partial[i].len;
+	}
+
+	spd.nr_pages = i;
+	ret = i ? splice_to_pipe(pipe, &spd) : 0;
+	splice_shrink_spd(pipe, &spd);
+
+	/* pages hold whole records, and move whole */
+	if (ret > 0)
+		__ipipe_stream_consume(ts, ret / IPIPE_STREAM_RECSZ);
+out:
+	mutex_unlock(&ts->lock);
+
+	return ret;
+}
+
+static const struct file_operations __ipipe_stream_fops = {
+	.open        = __ipipe_stream_open,
+	.read        = __ipipe_stream_read,
+	.splice_read = __ipipe_stream_splice_read,
+	.release     = __ipipe_stream_release,
+	.llseek      = no_llseek,
+};
+#endif /* CONFIG_IPIPE_TRACE_STREAM */
+
 static int __ipipe_rd_proc_val(char *page, char **start, off_t off,
                                int count, int *eof, void *data)
 {
@@ -1357,6 +1639,41 @@ __ipipe_create_trace_proc_val(struct proc_dir_entry *trace_dir,
 	return entry;
 }
 
+#ifdef CONFIG_IPIPE_TRACE_STREAM
+static void __init __ipipe_init_trace_stream(struct proc_dir_entry *trace_dir)
+{
+	struct proc_dir_entry *stream_dir;
+	struct proc_dir_entry *entry;
+	char name[16];
+	int cpu;
+
+	stream_dir = create_proc_entry("stream", S_IFDIR, trace_dir);
+	if (!stream_dir)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		mutex_init(&per_cpu(trace_stream, cpu).lock);
+		per_cpu(trace_stream, cpu).rec =
+			vmalloc_node(IPIPE_STREAM_POINTS * IPIPE_STREAM_RECSZ,
+				     cpu_to_node(cpu));
+		if (!per_cpu(trace_stream, cpu).rec) {
+			printk(KERN_ERR "I-pipe: "
+			       "insufficient memory for trace stream.\n");
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "cpu%d", cpu);
+		entry = create_proc_entry(name, 0444, stream_dir);
+		if (entry) {
+			entry->data = (void *)(long)cpu;
+			entry->proc_fops = &__ipipe_stream_fops;
+		}
+	}
+
+	__ipipe_create_trace_proc_val(stream_dir, "enable", &stream_enable);
+}
+#endif /* CONFIG_IPIPE_TRACE_STREAM */
+
 void __init __ipipe_init_tracer(void)
 {
 	struct proc_dir_entry *trace_dir;
@@ -1439,4 +1756,8 @@ void __init __ipipe_init_tracer(void)
 	if (entry)
 		entry->write_proc = __ipipe_wr_enable;
 #endif /* CONFIG_IPIPE_TRACE_MCOUNT */
+
+#ifdef CONFIG_IPIPE_TRACE_STREAM
+	__ipipe_init_trace_stream(trace_dir);
+#endif /* CONFIG_IPIPE_TRACE_STREAM */
 }
@@ -72,6 +72,7 @@
 #include <linux/ctype.h>
 #include <linux/ftrace.h>
 #include <linux/slab.h>
+#include <linux/jump_label.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
@@ -2727,6 +2728,110 @@ void preempt_notifier_unregister(struct preempt_notifier *notifier)
 }
 EXPORT_SYMBOL_GPL(preempt_notifier_unregister);
 
+/*
+ * Global preempt notifiers see every context switch on every CPU, not just
+ * those of the task that registered them, including the switches driven
+ * from the I-pipe head domain (rq == NULL in context_switch()). They sit
+ * behind a jump label, so the scheduler pays nothing while none is
+ * registered. As with the per-task ones, current is the task going out in
+ * ->sched_out() and the one coming in in ->sched_in(); either may be NULL.
+ * Every ->sched_out() is paired with a ->sched_in() on the resumed side,
+ * whichever path the switch took. The list is walked with hw interrupts
+ * off, so that unregistering can wait for head domain walkers too.
+ */
+static int global_preempt_notifiers_key;
+static unsigned int global_preempt_notifiers_count;
+static HLIST_HEAD(global_preempt_notifiers);
+static DEFINE_MUTEX(global_preempt_notifiers_mutex);
+
+/**
+ * preempt_notifier_register_global - tell me about every context switch
+ * @notifier: notifier struct to register
+ */
+void preempt_notifier_register_global(struct preempt_notifier *notifier)
+{
+	mutex_lock(&global_preempt_notifiers_mutex);
+	hlist_add_head_rcu(&notifier->link, &global_preempt_notifiers);
+	if (!global_preempt_notifiers_count++)
+		jump_label_enable(&global_preempt_notifiers_key);
+	mutex_unlock(&global_preempt_notifiers_mutex);
+}
+EXPORT_SYMBOL_GPL(preempt_notifier_register_global);
+
+/**
+ * preempt_notifier_unregister_global - stop context switch notifications
+ * @notifier: notifier struct to unregister
+ *
+ * Waits until no CPU can still be running @notifier's callbacks. Must not
+ * be called from within a preemption notifier.
+ */
+void preempt_notifier_unregister_global(struct preempt_notifier *notifier)
+{
+	mutex_lock(&global_preempt_notifiers_mutex);
+	hlist_del_rcu(&notifier->link);
+	if (!--global_preempt_notifiers_count)
+		jump_label_disable(&global_preempt_notifiers_key);
+	mutex_unlock(&global_preempt_notifiers_mutex);
+#ifdef CONFIG_IPIPE
+	{
+		unsigned long flags;
+
+		/*
+		 * synchronize_sched() knows nothing about the head
+		 * domain; the superlock is only granted once every
+		 * CPU has left its hw-masked notifier walk.
+		 */
+		flags = ipipe_critical_enter(NULL);
+		ipipe_critical_exit(flags);
+	}
+#endif
+	synchronize_sched();
+}
+EXPORT_SYMBOL_GPL(preempt_notifier_unregister_global);
+
+static void __fire_global_sched_in_preempt_notifiers(void)
+{
+	struct preempt_notifier *notifier;
+	struct hlist_node *node;
+	unsigned long flags;
+
+	local_irq_save_hw(flags);
+	rcu_read_lock_sched_notrace();
+	hlist_for_each_entry_rcu(notifier, node, &global_preempt_notifiers, link)
+		if (notifier->ops->sched_in)
+			notifier->ops->sched_in(notifier, raw_smp_processor_id());
+	rcu_read_unlock_sched_notrace();
+	local_irq_restore_hw(flags);
+}
+
+static void __fire_global_sched_out_preempt_notifiers(struct task_struct *next)
+{
+	struct preempt_notifier *notifier;
+	struct hlist_node *node;
+	unsigned long flags;
+
+	local_irq_save_hw(flags);
+	rcu_read_lock_sched_notrace();
+	hlist_for_each_entry_rcu(notifier, node, &global_preempt_notifiers, link)
+		if (notifier->ops->sched_out)
+			notifier->ops->sched_out(notifier, next);
+	rcu_read_unlock_sched_notrace();
+	local_irq_restore_hw(flags);
+}
+
+static __always_inline void fire_global_sched_in_preempt_notifiers(void)
+{
+	COND_STMT(&global_preempt_notifiers_key,
+		  __fire_global_sched_in_preempt_notifiers());
+}
+
+static __always_inline void
+fire_global_sched_out_preempt_notifiers(struct task_struct *next)
+{
+	COND_STMT(&global_preempt_notifiers_key,
+		  __fire_global_sched_out_preempt_notifiers(next));
+}
+
 static void fire_sched_in_preempt_notifiers(struct task_struct *curr)
 {
 	struct preempt_notifier *notifier;
@@ -2757,6 +2862,15 @@ static void fire_sched_out_preempt_notifiers(struct task_struct *curr, struct ta
 {
 }
 
+static inline void fire_global_sched_in_preempt_notifiers(void)
+{
+}
+
+static inline void
+fire_global_sched_out_preempt_notifiers(struct task_struct *next)
+{
+}
+
 #endif /* CONFIG_PREEMPT_NOTIFIERS */
 
 /**
@@ -2827,6 +2941,7 @@ static void finish_task_switch(struct rq *rq, struct task_struct *prev)
 	finish_lock_switch(rq, prev);
 
 	fire_sched_in_preempt_notifiers(current);
+	fire_global_sched_in_preempt_notifiers();
 	if (mm)
 		mmdrop(mm);
 	if (unlikely(prev_state == TASK_DEAD)) {
@@ -2912,27 +3027,7 @@ context_switch(struct rq *rq, struct task_struct *prev,
 {
 	struct mm_struct *mm, *oldmm;
 
-	//TODO:RAWLINSON...
-	if(task_cpu(prev) == CPUID_RTAI && task_cpu(next) == CPUID_RTAI && prev->pid != next->pid)
-	{
-//		pr_info("[RAWLINSON_SCHEDULE - context_switch]: PID(%d -> %d) STATE( %ld -> %ld )\n", prev->pid, next->pid, prev->state, next->state);
-		if(prev->pid > 0 && next->pid > 0 && prev->state == TASK_RUNNING && next->state == TASK_RUNNING) {
-			prev->flagPreemption = 1;
-		}
-		if(next->pid > 0 && next->flagPreemption && next->state == TASK_RUNNING) {
-			if(next->flagCheckedRawMonitor)
-			{
-				next->flagPreemption = 0;
-				next->flagCheckedRawMonitor = 0;
-				next->flagReturnPreemption = 0;
-			}
-			else
-			{
-				next->flagPreemption = 0;
-				next->flagReturnPreemption = 1;
-			}
-		}
-	}
+	fire_global_sched_out_preempt_notifiers(next);
 
 	mm = next->mm;
 	oldmm = prev->active_mm;
@@ -2985,8 +3080,11 @@ if (unlikely(rq)) {
 #else
 	prev->state &= ~TASK_ATOMICSWITCH;
 #endif
-	if (task_hijacked(prev))
-		return 1; __ipipe_dispatch_event(IPIPE_FIRST_EVENT - 2, 0);
+	if (task_hijacked(prev)) {
+		/* finish_task_switch() is skipped, pair the sched_out here. */
+		fire_global_sched_in_preempt_notifiers();
+		return 1;
+	}
 
 	/*
 	 * this_rq must be evaluated again because prev may have moved
@@ -2994,6 +3092,8 @@ if (unlikely(rq)) {
 	 * frame will be invalid.
 	 */
 	finish_task_switch(this_rq(), prev);
+} else {
+	fire_global_sched_in_preempt_notifiers();
 }
 
 	return 0;